@@ -0,0 +1,156 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Binary recording of the allocation stream (MHWM_RecordFile), replayed offline by
+// allocationreplay under other accounting rules (see AllocationReplay.cpp).
+//
+// The file is a header followed by a ring of fixed-width records, mapped shared. Every
+// accounted allocation, free and mapping is recorded with the edge (strand) it is charged
+// to, and the replay of the strand logs records where each edge ends (the spawn or sync
+// that follows it), in the serial order of the program. Workers claim the ring in chunks
+// with a single atomic add and fill them without locking; the edge ends are claimed one
+// by one under the replay lock, so their order in the ring is the serial order. The edge
+// ends of every window are followed by a window end, and those of its phases but the last
+// by a phase end: the recording spans all the windows.
+
+enum AllocationRecordOp : uint8_t {
+    RECORD_NONE = 0, // Slot of a chunk that was never filled.
+    RECORD_ALLOC,
+    RECORD_FREE,
+    RECORD_MAP,
+    RECORD_UNMAP,
+    RECORD_SPAWN,
+    RECORD_SYNC,
+    RECORD_WINDOW_END, // After the last edge end of a window.
+    RECORD_PHASE_END, // After the last edge end of a phase that isn't the last of its window.
+};
+
+struct AllocationRecord {
+    // Block or mapping (region id of spawns and syncs).
+    uint64_t address;
+    // Requested size of allocations, charged size of frees and mappings (function level of spawns and syncs).
+    uint64_t size;
+    // Edge the event is charged to (edge that ends at spawns and syncs).
+    uint32_t edge;
+    // Stack id of backtraced allocations and their frees, 0 otherwise.
+    uint32_t stackId;
+    // Usable size minus requested size of allocations.
+    uint32_t slack;
+    uint8_t op;
+    uint8_t reserved[3];
+};
+
+static_assert(sizeof(AllocationRecord) == 32, "Allocation records must be 32 bytes");
+
+struct AllocationRecordHeader {
+    char magic[8];
+    uint64_t recordSize;
+    // Records in the ring (a power of two).
+    uint64_t capacity;
+    // Records claimed by the writers: more than the capacity if the ring wrapped around.
+    std::atomic<uint64_t> claimed;
+    uint64_t reserved[4];
+};
+
+static_assert(sizeof(AllocationRecordHeader) == 64, "The recording header must be 64 bytes");
+
+constexpr char ALLOCATION_RECORD_MAGIC[8] = { 'M', 'H', 'W', 'M', 'R', 'E', 'C', '1' };
+
+class AllocationRecorder {
+public:
+    // Create the recording at 'path', with a ring of at most 'bytes' bytes.
+    bool Open(const char* path, size_t bytes) {
+        uint64_t capacity = CHUNK_RECORDS;
+        while (2 * capacity * sizeof(AllocationRecord) + sizeof(AllocationRecordHeader) <= bytes)
+            capacity *= 2;
+
+        int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return false;
+
+        size_t fileSize = sizeof(AllocationRecordHeader) + capacity * sizeof(AllocationRecord);
+        void* mem = MAP_FAILED;
+        if (ftruncate(fd, fileSize) == 0)
+            mem = (void*)syscall(SYS_mmap, nullptr, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+
+        if (mem == MAP_FAILED)
+            return false;
+
+        header = (AllocationRecordHeader*)mem;
+        memcpy(header->magic, ALLOCATION_RECORD_MAGIC, sizeof(header->magic));
+        header->recordSize = sizeof(AllocationRecord);
+        header->capacity = capacity;
+        header->claimed.store(0, std::memory_order_relaxed);
+
+        records = (AllocationRecord*)(header + 1);
+        mask = capacity - 1;
+        active = true;
+        return true;
+    }
+
+    // Stop recording. The mapping is kept, since workers may still be writing their last records.
+    void Close() { active = false; }
+
+    bool IsActive() const { return active; }
+
+    // Records claimed so far, and the capacity of the ring.
+    uint64_t GetClaimed() const { return header->claimed.load(std::memory_order_relaxed); }
+    uint64_t GetCapacity() const { return header->capacity; }
+
+    // Id of a new edge, 0 when not recording.
+    uint32_t NewEdgeId() {
+        return active ? nextEdgeId.fetch_add(1, std::memory_order_relaxed) : 0;
+    }
+
+    // Append a record to the chunk [next, end) of the calling thread, claiming a new one when it is full.
+    void Append(uint64_t& next, uint64_t& end, const AllocationRecord& record) {
+        if (next == end)
+        {
+            next = header->claimed.fetch_add(CHUNK_RECORDS, std::memory_order_relaxed);
+            end = next + CHUNK_RECORDS;
+        }
+
+        records[next++ & mask] = record;
+    }
+
+    // Record the end of 'edge' at a spawn or sync. Must be called in serial order (with the replay lock held).
+    void AppendEdgeEnd(bool spawn, uint32_t edge, uint64_t regionId, uint64_t level) {
+        AllocationRecord record = {};
+        record.address = regionId;
+        record.size = level;
+        record.edge = edge;
+        record.op = spawn ? RECORD_SPAWN : RECORD_SYNC;
+
+        records[header->claimed.fetch_add(1, std::memory_order_relaxed) & mask] = record;
+    }
+
+    // Record the end of the DAG whose edge ends were recorded last (RECORD_PHASE_END or
+    // RECORD_WINDOW_END). Must be called once they all were.
+    void AppendBoundary(AllocationRecordOp op) {
+        AllocationRecord record = {};
+        record.op = op;
+
+        records[header->claimed.fetch_add(1, std::memory_order_relaxed) & mask] = record;
+    }
+
+private:
+    static constexpr uint64_t CHUNK_RECORDS = 128;
+
+    bool active = false;
+    AllocationRecordHeader* header = nullptr;
+    AllocationRecord* records = nullptr;
+    uint64_t mask = 0;
+
+    std::atomic<uint32_t> nextEdgeId{ 1 };
+};
+
+// Defined in memoryhook.so, constant-initialized.
+extern AllocationRecorder allocationRecorder;
@@ -0,0 +1,512 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "SeriesParallelDAG.h"
+#include "SPEdgeProducer.h"
+#include "AllocationRecorder.h"
+#include "AllocatorModel.h"
+
+// Offline replay of an allocation recording (MHWM_RecordFile): recomputes the data of
+// every edge under another accounting rule, rebuilds the SP DAG of every window from the
+// recorded spawns and syncs, and reports its high-water marks, without running the program again.
+//   ./allocationreplay recording [requested|usable|glibc|jemalloc|tcmalloc] [p]
+//   ./allocationreplay recording lifetimes
+//
+//   requested -> allocations are charged the size the program asked for;
+//   usable    -> the usable size of the block (what the tool charges without USE_PAYLOAD);
+//   glibc, jemalloc, tcmalloc
+//             -> the footprint of the requested size under that allocator model (see
+//                AllocatorModel.h), with the expected resident set of its thread caches;
+//   lifetimes -> instead of the high-water marks, the lifetimes of the allocations of every
+//                site, in strands of the serial order, and the memory freed by strands
+//                logically parallel to the allocating ones.
+
+ToolArena toolArena;
+AllocatorModel allocatorModel;
+
+OutputPrinter out{ std::cout };
+
+enum class Rule { REQUESTED, USABLE, MODEL };
+
+struct LiveBlock {
+    uint64_t size;
+    uint64_t slack;
+};
+
+// Bytes charged for an allocation of 'size' requested bytes and 'slack' extra usable bytes.
+static uint64_t Charge(Rule rule, uint64_t size, uint64_t slack) {
+    switch (rule)
+    {
+    case Rule::REQUESTED:
+        return size;
+    case Rule::USABLE:
+        return size + slack;
+    case Rule::MODEL:
+    default:
+        return allocatorModel.Footprint(size);
+    }
+}
+
+static void Fail(const std::string& message) {
+    std::cerr << "ERROR: " << message << "\n";
+    exit(-1);
+}
+
+// Where the DAG of a phase or window ends: after 'edgeEnd' edge ends of the recording.
+struct DAGEnd {
+    size_t edgeEnd;
+    AllocationRecordOp op;
+};
+
+static void Report(SPNaiveComponent& aggregated, size_t p) {
+    for (size_t i = 1; i <= p; ++i)
+        std::cout << "Memory high-water mark for p = " << i << " : " << aggregated.GetWatermark(i) << "\n";
+
+    if (allocatorModel.IsActive())
+    {
+        for (size_t i = 1; i <= p; ++i)
+            std::cout << "Expected RSS for p = " << i << " : " << aggregated.GetWatermark(i, allocatorModel.GetWorkerOverhead())
+                << " (" << allocatorModel.GetName() << " model, " << allocatorModel.GetWorkerOverhead() << " bytes per worker)\n";
+    }
+}
+
+// Lifetimes are bucketed by powers of two: 0 (freed in the strand that allocated it), 1, 2-3, 4-7...
+static constexpr size_t NUM_LIFETIME_BUCKETS = 33;
+
+struct SiteLifetimes {
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+    uint64_t lifetimes[NUM_LIFETIME_BUCKETS] = {};
+    // Still allocated when the recording ends.
+    uint64_t liveAtExit = 0;
+    // Freed by a strand logically parallel to the allocating one.
+    uint64_t bytesFreedInParallel = 0;
+};
+
+static size_t LifetimeBucket(uint64_t lifetime) {
+    size_t bucket = 0;
+    for (; lifetime != 0 && bucket < NUM_LIFETIME_BUCKETS - 1; lifetime >>= 1)
+        bucket++;
+    return bucket;
+}
+
+// Names of the stack ids, written next to the recording by tools built with USE_BACKTRACE.
+static std::unordered_map<uint32_t, std::string> ReadSiteNames(const std::string& path) {
+    std::unordered_map<uint32_t, std::string> names;
+    std::ifstream file{ path };
+
+    uint32_t stackId;
+    std::string name;
+    while (file >> stackId && std::getline(file >> std::ws, name))
+        names[stackId] = name;
+
+    return names;
+}
+
+// Logical parallelism of the strands, followed over the edge ends in serial order with the
+// SP-bags algorithm (Feng and Leiserson). Every task (the root, and each spawned one) is an
+// element of a disjoint-set forest. The S-bag of a task holds the tasks that precede its
+// current strand; each region it spawned into has a P-bag, which holds the spawned tasks that
+// completed and are parallel to it until the region's sync. A strand of an earlier task is
+// parallel to the current strand if that task is in a P-bag.
+class SPBags {
+public:
+    SPBags() {
+        Reset();
+    }
+
+    // Element of the task of the current strand.
+    size_t GetCurrentTask() const {
+        return tasks.back().element;
+    }
+
+    bool IsParallel(size_t element) {
+        return parallel[Find(element)];
+    }
+
+    // The current strand ended with 'end': a spawn, a sync, or the exit of its task (a sync
+    // in region 0).
+    void EndStrand(const AllocationRecord& end) {
+        Task& task = tasks.back();
+
+        if (end.op == RECORD_SPAWN)
+        {
+            if (FindRegion(task, end.size, end.address) == task.regions.end())
+                task.regions.push_back({ end.size, end.address, NewBag(true) });
+            tasks.push_back({ NewBag(false), end.size, end.address, {} });
+        }
+        else if (end.address != 0)
+        {
+            auto region = FindRegion(task, end.size, end.address);
+            if (region != task.regions.end())
+            {
+                Union(region->pBag, task.element);
+                task.regions.erase(region);
+            }
+        }
+        else if (tasks.size() > 1) // Not the final sync of a window or phase.
+        {
+            Task child = std::move(tasks.back());
+            tasks.pop_back();
+            Task& parent = tasks.back();
+
+            // What the child didn't sync completes with it.
+            for (const Region& region : child.regions)
+                Union(region.pBag, child.element);
+
+            auto region = FindRegion(parent, child.spawnLevel, child.spawnRegion);
+            if (region != parent.regions.end())
+                Union(child.element, region->pBag);
+        }
+    }
+
+    // At the end of a window or phase, every strand precedes the next ones.
+    void Reset() {
+        parallel.assign(parallel.size(), false);
+        tasks.clear();
+        tasks.push_back({ NewBag(false), 0, 0, {} });
+    }
+
+private:
+    struct Region {
+        uint64_t level;
+        uint64_t id;
+        size_t pBag;
+    };
+
+    struct Task {
+        size_t element;
+        // Region of the parent the task was spawned into.
+        uint64_t spawnLevel;
+        uint64_t spawnRegion;
+        std::vector<Region> regions;
+    };
+
+    std::vector<size_t> parents;
+    std::vector<bool> parallel;
+    std::vector<Task> tasks;
+
+    size_t NewBag(bool isParallel) {
+        parents.push_back(parents.size());
+        parallel.push_back(isParallel);
+        return parents.size() - 1;
+    }
+
+    size_t Find(size_t element) {
+        size_t root = element;
+        while (parents[root] != root)
+            root = parents[root];
+
+        // Path compression.
+        while (parents[element] != root)
+        {
+            size_t next = parents[element];
+            parents[element] = root;
+            element = next;
+        }
+
+        return root;
+    }
+
+    // Move the bag of 'from' into the bag of 'into', which keeps its kind.
+    void Union(size_t from, size_t into) {
+        size_t fromRoot = Find(from);
+        size_t intoRoot = Find(into);
+        if (fromRoot != intoRoot)
+            parents[fromRoot] = intoRoot;
+    }
+
+    static std::vector<Region>::iterator FindRegion(Task& task, uint64_t level, uint64_t id) {
+        return std::find_if(task.regions.begin(), task.regions.end(), [&](const Region& region)
+        {
+            return region.level == level && region.id == id;
+        });
+    }
+};
+
+// Replay the allocations and frees in the serial order of their edges, and report per site
+// (stack id) how many strands its blocks live for, and how much is freed by a strand that is
+// logically parallel to the allocating one.
+static void ReportLifetimes(const std::vector<const AllocationRecord*>& edgeEnds, const std::vector<DAGEnd>& dagEnds,
+    std::unordered_map<uint32_t, std::vector<const AllocationRecord*>>& edgeEvents, const std::string& recording) {
+
+    struct Birth {
+        uint64_t size;
+        size_t edgeIndex;
+        size_t task;
+        uint32_t stackId;
+    };
+
+    std::unordered_map<uint64_t, Birth> liveBlocks;
+    std::unordered_map<uint32_t, SiteLifetimes> sites;
+    uint64_t bytesFreed = 0;
+    uint64_t bytesFreedInParallel = 0;
+    SPBags bags;
+    auto dagEnd = dagEnds.begin();
+
+    for (size_t edgeIndex = 0; edgeIndex < edgeEnds.size(); ++edgeIndex)
+    {
+        for (const AllocationRecord* record : edgeEvents[edgeEnds[edgeIndex]->edge])
+        {
+            if (record->op == RECORD_ALLOC)
+            {
+                liveBlocks[record->address] = { record->size, edgeIndex, bags.GetCurrentTask(), record->stackId };
+
+                SiteLifetimes& site = sites[record->stackId];
+                site.allocations++;
+                site.bytes += record->size;
+            }
+            else if (record->op == RECORD_FREE)
+            {
+                auto it = liveBlocks.find(record->address);
+                if (it == liveBlocks.end())
+                    continue;
+
+                const Birth& birth = it->second;
+                SiteLifetimes& site = sites[birth.stackId];
+                site.lifetimes[LifetimeBucket(edgeIndex - birth.edgeIndex)]++;
+
+                bytesFreed += birth.size;
+                if (bags.IsParallel(birth.task))
+                {
+                    site.bytesFreedInParallel += birth.size;
+                    bytesFreedInParallel += birth.size;
+                }
+
+                liveBlocks.erase(it);
+            }
+        }
+
+        bags.EndStrand(*edgeEnds[edgeIndex]);
+        for (; dagEnd != dagEnds.end() && dagEnd->edgeEnd == edgeIndex + 1; ++dagEnd)
+            bags.Reset();
+    }
+
+    for (const auto& block : liveBlocks)
+        sites[block.second.stackId].liveAtExit++;
+
+    // The sites with the most memory freed in parallel first: they are the ones to restructure.
+    std::vector<std::pair<uint32_t, const SiteLifetimes*>> ordered;
+    for (const auto& site : sites)
+        ordered.emplace_back(site.first, &site.second);
+    std::sort(ordered.begin(), ordered.end(), [](const std::pair<uint32_t, const SiteLifetimes*>& a, const std::pair<uint32_t, const SiteLifetimes*>& b)
+    {
+        if (a.second->bytesFreedInParallel != b.second->bytesFreedInParallel)
+            return a.second->bytesFreedInParallel > b.second->bytesFreedInParallel;
+        return a.second->bytes > b.second->bytes;
+    });
+
+    auto names = ReadSiteNames(recording + ".sites");
+
+    std::cout << "Allocation lifetimes, in strands of the serial order (0: freed by the strand that allocated it)\n";
+    for (const auto& entry : ordered)
+    {
+        const SiteLifetimes& site = *entry.second;
+        auto name = names.find(entry.first);
+
+        std::cout << "[" << (entry.first == 0 ? "not backtraced" : name != names.end() ? name->second : "stack " + std::to_string(entry.first)) << "]: "
+            << site.allocations << " allocations, " << site.bytes << " bytes, " << site.bytesFreedInParallel << " bytes freed in parallel\n   ";
+
+        for (size_t bucket = 0; bucket < NUM_LIFETIME_BUCKETS; ++bucket)
+        {
+            if (site.lifetimes[bucket] == 0)
+                continue;
+
+            if (bucket <= 1)
+                std::cout << " " << bucket;
+            else
+                std::cout << " " << (1ULL << (bucket - 1)) << "-" << (1ULL << bucket) - 1;
+            std::cout << ": " << site.lifetimes[bucket];
+        }
+
+        if (site.liveAtExit != 0)
+            std::cout << " live at exit: " << site.liveAtExit;
+        std::cout << "\n";
+    }
+
+    std::cout << "Freed by a strand logically parallel to the allocating one: " << bytesFreedInParallel << " of " << bytesFreed << " bytes freed\n";
+}
+
+int main(int argc, char** argv) {
+    out.SetActive(false);
+
+    if (argc < 2)
+        Fail("usage: allocationreplay recording [requested|usable|glibc|jemalloc|tcmalloc|lifetimes] [p]");
+
+    Rule rule = Rule::USABLE;
+    bool lifetimes = false;
+    if (argc > 2)
+    {
+        if (strcmp(argv[2], "lifetimes") == 0)
+            lifetimes = true;
+        else if (strcmp(argv[2], "requested") == 0)
+            rule = Rule::REQUESTED;
+        else if (strcmp(argv[2], "usable") == 0)
+            rule = Rule::USABLE;
+        else if (strcmp(argv[2], "none") != 0 && allocatorModel.Select(argv[2]))
+            rule = Rule::MODEL;
+        else
+            Fail(std::string("unknown accounting rule ") + argv[2]);
+    }
+
+    size_t p = argc > 3 ? std::atoll(argv[3]) : 2;
+    if (p <= 0)
+        Fail("p must be set to a positive value");
+
+    int fd = open(argv[1], O_RDONLY);
+    struct stat fileStat;
+    if (fd < 0 || fstat(fd, &fileStat) != 0 || (size_t)fileStat.st_size < sizeof(AllocationRecordHeader))
+        Fail(std::string("cannot read the recording ") + argv[1]);
+
+    void* mem = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED)
+        Fail(std::string("cannot map the recording ") + argv[1]);
+
+    const AllocationRecordHeader* header = (const AllocationRecordHeader*)mem;
+    const AllocationRecord* records = (const AllocationRecord*)(header + 1);
+
+    if (memcmp(header->magic, ALLOCATION_RECORD_MAGIC, sizeof(header->magic)) != 0 || header->recordSize != sizeof(AllocationRecord) ||
+        sizeof(AllocationRecordHeader) + header->capacity * sizeof(AllocationRecord) > (size_t)fileStat.st_size)
+        Fail(std::string(argv[1]) + " is not an allocation recording");
+
+    uint64_t claimed = header->claimed.load(std::memory_order_relaxed);
+    if (claimed > header->capacity)
+        Fail("the recording wrapped around and lost " + std::to_string(claimed - header->capacity) + " records, increase MHWM_RecordSize");
+
+    // Group the events of each edge (a worker records them in order) and list the edge ends,
+    // and where the phases and windows end among them.
+    std::unordered_map<uint32_t, std::vector<const AllocationRecord*>> edgeEvents;
+    std::vector<const AllocationRecord*> edgeEnds;
+    std::vector<DAGEnd> dagEnds;
+
+    for (uint64_t i = 0; i < claimed; ++i)
+    {
+        const AllocationRecord& record = records[i];
+        if (record.op == RECORD_SPAWN || record.op == RECORD_SYNC)
+            edgeEnds.push_back(&record);
+        else if (record.op == RECORD_PHASE_END || record.op == RECORD_WINDOW_END)
+            dagEnds.push_back({ edgeEnds.size(), (AllocationRecordOp)record.op });
+        else if (record.op != RECORD_NONE)
+            edgeEvents[record.edge].push_back(&record);
+    }
+
+    if (edgeEnds.empty())
+        Fail("the recording has no spawns or syncs (did the program exit normally?)");
+
+    // Edge ends after the last window end belong to a window that wasn't closed.
+    if (dagEnds.empty() || dagEnds.back().edgeEnd != edgeEnds.size())
+        dagEnds.push_back({ edgeEnds.size(), RECORD_WINDOW_END });
+
+    if (lifetimes)
+    {
+        ReportLifetimes(edgeEnds, dagEnds, edgeEvents, argv[1]);
+        return 0;
+    }
+
+    // Replay the edges in serial order, so that a block is allocated before it is freed.
+    // Blocks allocated in a window and freed in a later one are uncharged there.
+    std::unordered_map<uint64_t, LiveBlock> liveBlocks;
+    std::vector<std::vector<SPNaiveComponent>> windows(1);
+    size_t numEvents = 0;
+    size_t dagStart = 0;
+
+    for (const DAGEnd& dagEnd : dagEnds)
+    {
+        FullSPDAG dag{ out };
+
+        for (size_t i = dagStart; i < dagEnd.edgeEnd; ++i)
+        {
+            const AllocationRecord* end = edgeEnds[i];
+            SPEdgeData data;
+
+            for (const AllocationRecord* record : edgeEvents[end->edge])
+            {
+                switch (record->op)
+                {
+                case RECORD_ALLOC:
+                    data.memAllocated += Charge(rule, record->size, record->slack);
+                    liveBlocks[record->address] = { record->size, record->slack };
+                    break;
+                case RECORD_FREE:
+                {
+                    // Blocks allocated before the recording started are uncharged what the tool uncharged.
+                    auto it = liveBlocks.find(record->address);
+                    if (it != liveBlocks.end())
+                    {
+                        data.memAllocated -= Charge(rule, it->second.size, it->second.slack);
+                        liveBlocks.erase(it);
+                    }
+                    else
+                        data.memAllocated -= record->size;
+                    break;
+                }
+                case RECORD_MAP:
+                    data.memAllocated += record->size;
+                    break;
+                case RECORD_UNMAP:
+                    data.memAllocated -= record->size;
+                    break;
+                }
+
+                if (data.memAllocated > data.maxMemAllocated)
+                    data.maxMemAllocated = data.memAllocated;
+            }
+
+            numEvents += edgeEvents[end->edge].size();
+
+            dag.SetLevel(end->size);
+            if (end->op == RECORD_SPAWN)
+                dag.Spawn(data, end->address);
+            else
+                dag.Sync(data, end->address);
+        }
+
+        if (!dag.IsComplete())
+            Fail("the recording ends before the program does");
+
+        SPEdgeFullOnlineProducer producer{ &dag };
+        windows.back().push_back(dag.AggregateComponentsNaive(&producer, nullptr, 0, p));
+        if (dagEnd.op == RECORD_WINDOW_END && dagEnd.edgeEnd != edgeEnds.size())
+            windows.emplace_back();
+        dagStart = dagEnd.edgeEnd;
+    }
+
+    std::cout << "Replayed " << numEvents << " allocation events over " << edgeEnds.size() << " edges\n";
+
+    for (size_t window = 0; window < windows.size(); ++window)
+    {
+        if (windows.size() > 1)
+            std::cout << "Window " << window + 1 << ":\n";
+
+        std::vector<SPNaiveComponent>& phases = windows[window];
+        if (phases.size() == 1)
+        {
+            Report(phases[0], p);
+            continue;
+        }
+
+        // The phases of a window run one after the other.
+        SPNaiveComponent whole{ p };
+        for (size_t phase = 0; phase < phases.size(); ++phase)
+        {
+            std::cout << "Phase " << phase + 1 << ":\n";
+            Report(phases[phase], p);
+            whole.CombineSeries(phases[phase]);
+        }
+
+        std::cout << "Whole window (" << phases.size() << " phases):\n";
+        Report(whole, p);
+    }
+
+    return 0;
+}
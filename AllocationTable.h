@@ -0,0 +1,190 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "common.h"
+
+// Shadow metadata of the live allocations (size and stack id), keyed by address.
+//
+// The table is sharded by address and open-addressed with a bounded probe window.
+// Inserts, lookups and removals are lock-free: a slot is claimed with a CAS on its
+// address, and removed by turning it into a tombstone (slots never become empty
+// again, so a lookup can stop at the first empty slot). When the window of every
+// segment of a shard is full, the shard takes its lock and adds a segment twice
+// as large. Segments are mapped with the raw system call, so the table never goes
+// through the hooked malloc or mmap and never shares pages with the measured program.
+class AllocationTable {
+public:
+    // Sizes that don't fit in 32 bits are stored as SIZE_UNKNOWN.
+    static constexpr uint32_t SIZE_UNKNOWN = UINT32_MAX;
+
+    struct Entry {
+        std::atomic<uintptr_t> address;
+        uint32_t size;
+        uint32_t stackId;
+    };
+
+    static_assert(sizeof(Entry) == 16, "Allocation table entries must be 16 bytes");
+
+    void Insert(void* mem, size_t size, uint32_t stackId) {
+        if (mem == nullptr)
+            return;
+
+        uintptr_t address = (uintptr_t)mem;
+        uint64_t hash = Hash(address);
+        Shard& shard = shards[hash % NUM_SHARDS];
+        uint64_t slot = hash / NUM_SHARDS;
+
+        Segment* last = nullptr;
+        Segment* segment = shard.head.load(std::memory_order_acquire);
+        while (true)
+        {
+            for (; segment != nullptr; segment = segment->next.load(std::memory_order_acquire))
+            {
+                last = segment;
+                for (size_t i = 0; i < MAX_PROBES; ++i)
+                {
+                    Entry& entry = segment->Entries()[(slot + i) & segment->mask];
+                    uintptr_t current = entry.address.load(std::memory_order_relaxed);
+
+                    if ((current == EMPTY || current == TOMBSTONE) &&
+                        entry.address.compare_exchange_strong(current, address, std::memory_order_acq_rel))
+                    {
+                        // Nobody else can look up this address before the allocation is returned.
+                        entry.size = size < SIZE_UNKNOWN ? (uint32_t)size : SIZE_UNKNOWN;
+                        entry.stackId = stackId;
+                        return;
+                    }
+                }
+            }
+
+            segment = AddSegment(shard, last);
+        }
+    }
+
+    // Remove the entry of 'mem', if any, returning its metadata.
+    bool Take(void* mem, uint32_t& size, uint32_t& stackId) {
+        Entry* entry = Find(mem);
+        if (entry == nullptr)
+            return false;
+
+        size = entry->size;
+        stackId = entry->stackId;
+        entry->address.store(TOMBSTONE, std::memory_order_release);
+        return true;
+    }
+
+    Entry* Find(void* mem) {
+        uintptr_t address = (uintptr_t)mem;
+        uint64_t hash = Hash(address);
+        Shard& shard = shards[hash % NUM_SHARDS];
+        uint64_t slot = hash / NUM_SHARDS;
+
+        for (Segment* segment = shard.head.load(std::memory_order_acquire); segment != nullptr;
+            segment = segment->next.load(std::memory_order_acquire))
+        {
+            for (size_t i = 0; i < MAX_PROBES; ++i)
+            {
+                Entry& entry = segment->Entries()[(slot + i) & segment->mask];
+                uintptr_t current = entry.address.load(std::memory_order_acquire);
+
+                if (current == address)
+                    return &entry;
+                if (current == EMPTY) // Inserts always take the first free slot of the window.
+                    return nullptr;
+            }
+        }
+
+        return nullptr;
+    }
+
+    // Walks the whole table: only meant for reporting.
+    void GetStats(size_t& liveEntries, size_t& reservedBytes) {
+        liveEntries = 0;
+        reservedBytes = 0;
+
+        for (Shard& shard : shards)
+        {
+            for (Segment* segment = shard.head.load(std::memory_order_acquire); segment != nullptr;
+                segment = segment->next.load(std::memory_order_acquire))
+            {
+                reservedBytes += SegmentBytes(segment->mask + 1);
+                for (size_t i = 0; i <= segment->mask; ++i)
+                {
+                    uintptr_t current = segment->Entries()[i].address.load(std::memory_order_relaxed);
+                    if (current != EMPTY && current != TOMBSTONE)
+                        liveEntries++;
+                }
+            }
+        }
+    }
+
+private:
+    static constexpr uintptr_t EMPTY = 0;
+    static constexpr uintptr_t TOMBSTONE = 1;
+
+    static constexpr size_t NUM_SHARDS = 64;
+    static constexpr size_t MAX_PROBES = 16;
+    static constexpr size_t FIRST_SEGMENT_ENTRIES = 1024;
+
+    // The segment header takes the place of the first entry.
+    struct Segment {
+        std::atomic<Segment*> next;
+        size_t mask;
+
+        Entry* Entries() { return (Entry*)this + 1; }
+    };
+
+    static_assert(sizeof(Segment) <= sizeof(Entry), "Segment header must fit in one entry");
+
+    struct Shard {
+        std::atomic<Segment*> head{ nullptr };
+        std::atomic<Segment*> tail{ nullptr };
+        std::mutex mutex;
+    };
+
+    static uint64_t Hash(uintptr_t address) {
+        uint64_t h = address >> 4; // malloc returns 16-byte aligned blocks.
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    static size_t SegmentBytes(size_t numEntries) {
+        return sizeof(Entry) * (numEntries + 1);
+    }
+
+    // Append a segment after 'last' and return the first segment that follows it
+    // (another thread may already have added one).
+    Segment* AddSegment(Shard& shard, Segment* last) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        Segment* tail = shard.tail.load(std::memory_order_acquire);
+        if (tail != last)
+            return last == nullptr ? shard.head.load(std::memory_order_acquire) : last->next.load(std::memory_order_acquire);
+
+        size_t numEntries = tail == nullptr ? FIRST_SEGMENT_ENTRIES : 2 * (tail->mask + 1);
+
+        void* mem = (void*)syscall(SYS_mmap, nullptr, SegmentBytes(numEntries), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        DEBUG_ASSERT(mem != MAP_FAILED);
+
+        Segment* segment = (Segment*)mem;
+        segment->next.store(nullptr, std::memory_order_relaxed);
+        segment->mask = numEntries - 1;
+
+        if (tail == nullptr)
+            shard.head.store(segment, std::memory_order_release);
+        else
+            tail->next.store(segment, std::memory_order_release);
+        shard.tail.store(segment, std::memory_order_release);
+
+        return segment;
+    }
+
+    Shard shards[NUM_SHARDS];
+};
@@ -0,0 +1,162 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <atomic>
+
+extern "C" {
+    extern void* __libc_malloc(size_t);
+    extern void __libc_free(void*);
+    extern void* __libc_calloc(size_t, size_t);
+    extern void* __libc_realloc(void*, size_t);
+    extern void* __libc_memalign(size_t alignment, size_t size);
+}
+
+// The allocator that serves the program's blocks: the hooks only account them.
+//
+// It is glibc's by default. MHWM_Allocator selects another one, either "next" (the
+// malloc that follows memoryhook.so in the symbol search order, e.g. one linked into
+// the program) or the path of a shared object (e.g. libjemalloc.so), resolved the
+// first time the program allocates. dlopen and dlsym allocate themselves, so the
+// blocks they ask for while the allocator is being resolved come from a static
+// bootstrap arena, and are never given back.
+class AllocatorBackend {
+public:
+    void* Malloc(size_t size) { return GetFunctions().malloc(size); }
+    void* Calloc(size_t num, size_t size) { return GetFunctions().calloc(num, size); }
+    void* Memalign(size_t alignment, size_t size) { return GetFunctions().memalign(alignment, size); }
+
+    void Free(void* mem) {
+        if (!IsBootstrapBlock(mem))
+            GetFunctions().free(mem);
+    }
+
+    void* Realloc(void* mem, size_t size) {
+        if (!IsBootstrapBlock(mem))
+            return GetFunctions().realloc(mem, size);
+
+        void* newMem = Malloc(size);
+        if (newMem != nullptr)
+            memcpy(newMem, mem, size < BootstrapSize(mem) ? size : BootstrapSize(mem));
+        return newMem;
+    }
+
+    size_t UsableSize(void* mem) {
+        if (IsBootstrapBlock(mem))
+            return BootstrapSize(mem);
+        return GetFunctions().usableSize(mem);
+    }
+
+    const char* GetName() { return GetFunctions().name; }
+
+private:
+    struct Functions {
+        const char* name;
+        void* (*malloc)(size_t);
+        void (*free)(void*);
+        void* (*calloc)(size_t, size_t);
+        void* (*realloc)(void*, size_t);
+        void* (*memalign)(size_t, size_t);
+        size_t(*usableSize)(void*);
+    };
+
+    enum State { UNRESOLVED, RESOLVING, READY };
+
+    static constexpr size_t BOOTSTRAP_BYTES = 256 * 1024;
+    static constexpr size_t BOOTSTRAP_HEADER = 16;
+
+    Functions& GetFunctions() {
+        if (__builtin_expect(state.load(std::memory_order_acquire) != READY, 0))
+            return Resolve();
+        return functions;
+    }
+
+    __attribute__((noinline)) Functions& Resolve() {
+        int expected = UNRESOLVED;
+        if (!state.compare_exchange_strong(expected, RESOLVING))
+            return expected == RESOLVING ? bootstrap : functions;
+
+        const char* name = getenv("MHWM_Allocator");
+        if (name != nullptr && name[0] != '\0')
+        {
+            void* handle = strcmp(name, "next") == 0 ? RTLD_NEXT : dlopen(name, RTLD_NOW | RTLD_LOCAL);
+            if (handle == nullptr)
+                Fail(name, "cannot be loaded");
+
+            Functions resolved = { name };
+            resolved.malloc = (void* (*)(size_t))dlsym(handle, "malloc");
+            resolved.free = (void (*)(void*))dlsym(handle, "free");
+            resolved.calloc = (void* (*)(size_t, size_t))dlsym(handle, "calloc");
+            resolved.realloc = (void* (*)(void*, size_t))dlsym(handle, "realloc");
+            resolved.memalign = (void* (*)(size_t, size_t))dlsym(handle, "memalign");
+            if (resolved.memalign == nullptr)
+                resolved.memalign = (void* (*)(size_t, size_t))dlsym(handle, "aligned_alloc");
+            resolved.usableSize = (size_t(*)(void*))dlsym(handle, "malloc_usable_size");
+
+            if (resolved.malloc == nullptr || resolved.free == nullptr || resolved.calloc == nullptr ||
+                resolved.realloc == nullptr || resolved.memalign == nullptr || resolved.usableSize == nullptr)
+                Fail(name, "doesn't export the malloc API (malloc, free, calloc, realloc, memalign, malloc_usable_size)");
+
+            functions = resolved;
+        }
+
+        state.store(READY, std::memory_order_release);
+        return functions;
+    }
+
+    static void Fail(const char* name, const char* reason) {
+        fprintf(stderr, "ERROR: the allocator %s %s\n", name, reason);
+        exit(-1);
+    }
+
+    static bool IsBootstrapBlock(void* mem) {
+        return (uintptr_t)mem - (uintptr_t)bootstrapArena < BOOTSTRAP_BYTES;
+    }
+
+    static size_t BootstrapSize(void* mem) {
+        return *(size_t*)((char*)mem - BOOTSTRAP_HEADER);
+    }
+
+    static void* BootstrapMemalign(size_t alignment, size_t size) {
+        if (alignment < BOOTSTRAP_HEADER)
+            alignment = BOOTSTRAP_HEADER;
+        size = (size + BOOTSTRAP_HEADER - 1) & ~(BOOTSTRAP_HEADER - 1);
+
+        size_t offset = bootstrapUsed.load(std::memory_order_relaxed);
+        size_t start;
+        do
+        {
+            start = (offset + BOOTSTRAP_HEADER + alignment - 1) & ~(alignment - 1);
+            if (start + size > BOOTSTRAP_BYTES)
+                return nullptr;
+        } while (!bootstrapUsed.compare_exchange_weak(offset, start + size, std::memory_order_relaxed));
+
+        *(size_t*)(bootstrapArena + start - BOOTSTRAP_HEADER) = size;
+        return bootstrapArena + start;
+    }
+
+    static void* BootstrapMalloc(size_t size) { return BootstrapMemalign(BOOTSTRAP_HEADER, size); }
+    static void BootstrapFree(void*) {}
+
+    // The arena is zero-filled.
+    static void* BootstrapCalloc(size_t num, size_t size) { return BootstrapMalloc(num * size); }
+
+    static void* BootstrapRealloc(void* mem, size_t size) {
+        void* newMem = BootstrapMalloc(size);
+        if (newMem != nullptr && mem != nullptr)
+            memcpy(newMem, mem, size < BootstrapSize(mem) ? size : BootstrapSize(mem));
+        return newMem;
+    }
+
+    std::atomic<int> state{ UNRESOLVED };
+    Functions functions = { "glibc", __libc_malloc, __libc_free, __libc_calloc, __libc_realloc, __libc_memalign, malloc_usable_size };
+    Functions bootstrap = { "bootstrap", BootstrapMalloc, BootstrapFree, BootstrapCalloc, BootstrapRealloc, BootstrapMemalign, BootstrapSize };
+
+    alignas(4096) static char bootstrapArena[BOOTSTRAP_BYTES];
+    static std::atomic<size_t> bootstrapUsed;
+};
@@ -0,0 +1,123 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Model of the memory an allocator really uses (MHWM_AllocatorModel): the footprint of a
+// block of a given size once rounded to the allocator's size classes, and the memory
+// every worker holds in the allocator's thread cache. Allocations are charged their
+// footprint, and the per-worker overhead is added to the high-water marks to report the
+// expected resident set. Sizes are requested sizes with USE_PAYLOAD, and usable sizes of
+// the actual allocator otherwise (a slight overestimate when it isn't the modeled one).
+class AllocatorModel {
+public:
+    enum Kind { NONE, GLIBC, JEMALLOC, TCMALLOC };
+
+    // Select a preset by name ("glibc", "jemalloc", "tcmalloc" or "none").
+    bool Select(const char* name) {
+        if (strcmp(name, "none") == 0)
+            kind = NONE;
+        else if (strcmp(name, "glibc") == 0)
+            kind = GLIBC;
+        else if (strcmp(name, "jemalloc") == 0)
+            kind = JEMALLOC;
+        else if (strcmp(name, "tcmalloc") == 0)
+            kind = TCMALLOC;
+        else
+            return false;
+
+        workerOverhead = DefaultWorkerOverhead(kind);
+        return true;
+    }
+
+    bool IsActive() const { return kind != NONE; }
+
+    const char* GetName() const {
+        static const char* names[] = { "none", "glibc", "jemalloc", "tcmalloc" };
+        return names[kind];
+    }
+
+    // Bytes a worker holds in the allocator outside the program's live blocks.
+    int64_t GetWorkerOverhead() const { return workerOverhead; }
+    void SetWorkerOverhead(int64_t bytes) { workerOverhead = bytes; }
+
+    // Bytes the allocator uses for a block of 'size' bytes.
+    size_t Footprint(size_t size) const {
+        if (size == 0)
+            size = 1;
+
+        switch (kind)
+        {
+        case GLIBC:
+            // Chunks hold an 8-byte header and are multiples of 16 bytes, of at least 32. Blocks
+            // above the mmap threshold (128 KiB by default) are mapped: a 16-byte header, in pages.
+            if (size >= 128 * 1024)
+                return RoundUp(size + 2 * sizeof(size_t), GLIBC_PAGE_SIZE);
+            return size + sizeof(size_t) <= 32 ? 32 : RoundUp(size + sizeof(size_t), 16);
+
+        case JEMALLOC:
+            // 8, then multiples of 16 up to 128, then four classes per doubling.
+            if (size <= 8)
+                return 8;
+            if (size <= 128)
+                return RoundUp(size, 16);
+            return RoundUp(size, (size_t)1 << (FloorLog2(size - 1) - 2));
+
+        case TCMALLOC:
+            // 8, then multiples of 16 up to 128, then eight classes per doubling up to the
+            // 256 KiB of the largest class, whose spacing is at most a page; then pages.
+            if (size <= 8)
+                return 8;
+            if (size <= 128)
+                return RoundUp(size, 16);
+            if (size <= 256 * 1024)
+            {
+                size_t spacing = (size_t)1 << (FloorLog2(size - 1) - 3);
+                return RoundUp(size, spacing < TCMALLOC_PAGE_SIZE ? spacing : TCMALLOC_PAGE_SIZE);
+            }
+            return RoundUp(size, TCMALLOC_PAGE_SIZE);
+
+        case NONE:
+        default:
+            return size;
+        }
+    }
+
+private:
+    static constexpr size_t GLIBC_PAGE_SIZE = 4096;
+    static constexpr size_t TCMALLOC_PAGE_SIZE = 8192;
+
+    static size_t RoundUp(size_t size, size_t multiple) {
+        return (size + multiple - 1) / multiple * multiple;
+    }
+
+    static size_t FloorLog2(size_t value) {
+        return 63 - __builtin_clzll(value);
+    }
+
+    // Rough bounds of what the default thread caches hold:
+    //   glibc:    a full tcache (7 chunks of each of the 64 sizes from 32 to 1040 bytes) and the
+    //             128 KiB of free top chunk an arena keeps before trimming;
+    //   jemalloc: about 1 MiB of small and large (up to 32 KiB) cached regions;
+    //   tcmalloc: the 4 MiB maximum size of a thread cache.
+    static int64_t DefaultWorkerOverhead(Kind kind) {
+        switch (kind)
+        {
+        case GLIBC:
+            return 7 * (64 * 32 + 16 * (63 * 64 / 2)) + 128 * 1024;
+        case JEMALLOC:
+            return 1 << 20;
+        case TCMALLOC:
+            return 4 << 20;
+        case NONE:
+        default:
+            return 0;
+        }
+    }
+
+    Kind kind = NONE;
+    int64_t workerOverhead = 0;
+};
+
+// Defined in memoryhook.so, constant-initialized.
+extern AllocatorModel allocatorModel;
@@ -28,6 +28,7 @@ void BareboneSPDAG::Spawn(SPEdgeData & currentEdge, size_t regionId) {
 void BareboneSPDAG::Sync(SPEdgeData & currentEdge, size_t regionId) {
     if (!spawnedAtLeastOnce) // If there wasn't a spawn before, this is the final simulated sync.
     {
+        serialEdge = currentEdge;
         isComplete = true;
         return;
     }
@@ -66,7 +67,7 @@ void BareboneSPDAG::Sync(SPEdgeData & currentEdge, size_t regionId) {
 
 SPComponent BareboneSPDAG::AggregateComponents(SPEdgeProducer * edgeProducer, SPEventBareboneOnlineProducer* eventProducer, int64_t threshold) {
     if (IsComplete() && !spawnedAtLeastOnce)
-        return SPComponent();
+        return SPComponent(serialEdge);
 
     SPComponent start{ edgeProducer->NextData() };
 
@@ -219,7 +220,7 @@ SPNaiveComponent BareboneSPDAG::AggregateUntilSyncNaive(SPEdgeProducer * edgePro
 
 SPComponent BareboneSPDAG::AggregateComponentsEfficient(SPEdgeProducer * edgeProducer, SPEventBareboneOnlineProducer * eventProducer, int64_t threshold) {
     if (IsComplete() && !spawnedAtLeastOnce)
-        return SPComponent();
+        return SPComponent(serialEdge);
 
     SPEvent event = eventProducer->Next();
     DEBUG_ASSERT(event.spawn);
@@ -255,7 +256,7 @@ SPComponent BareboneSPDAG::AggregateComponentsEfficient(SPEdgeProducer * edgePro
 
 SPNaiveComponent BareboneSPDAG::AggregateComponentsNaive(SPEdgeProducer * edgeProducer, SPEventBareboneOnlineProducer * eventProducer, int64_t threshold, size_t p) {
     if (IsComplete() && !spawnedAtLeastOnce)
-        return SPNaiveComponent(SPEdgeData(), 1);
+        return SPNaiveComponent(serialEdge, p);
 
     SPNaiveComponent start{ edgeProducer->NextData(), p };
 
@@ -294,7 +295,7 @@ SPNaiveComponent BareboneSPDAG::AggregateComponentsNaive(SPEdgeProducer * edgePr
 
 SPNaiveComponent BareboneSPDAG::AggregateComponentsNaiveEfficient(SPEdgeProducer * edgeProducer, SPEventBareboneOnlineProducer * eventProducer, int64_t threshold, size_t p) {
     if (IsComplete() && !spawnedAtLeastOnce)
-        return SPNaiveComponent(SPEdgeData(), 1);
+        return SPNaiveComponent(serialEdge, p);
 
     SPEvent event = eventProducer->Next();
     DEBUG_ASSERT(event.spawn);
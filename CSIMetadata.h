@@ -0,0 +1,157 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#ifdef USE_OMPT
+// The OpenMP front-end (OmptHooks.cpp) is built with a stock compiler, without CSI's header, and
+// no CSI unit is ever added: declare the parts of the CSI interface that the tool refers to.
+typedef int64_t csi_id_t;
+
+typedef struct {
+    char* name;
+    int32_t line_number;
+    int32_t column_number;
+    char* filename;
+} source_loc_t;
+
+typedef struct {
+    csi_id_t num_func;
+    csi_id_t num_detach;
+    csi_id_t num_task_exit;
+    csi_id_t num_sync;
+} instrumentation_counts_t;
+
+typedef struct {
+    uint64_t is_indirect : 1;
+    uint64_t _padding : 63;
+} call_prop_t;
+
+extern "C" {
+    const source_loc_t* __csi_get_func_source_loc(const csi_id_t func_id);
+    const source_loc_t* __csi_get_detach_source_loc(const csi_id_t detach_id);
+    const source_loc_t* __csi_get_task_exit_source_loc(const csi_id_t task_exit_id);
+    const source_loc_t* __csi_get_sync_source_loc(const csi_id_t sync_id);
+}
+#else
+#include <csi/csi.h>
+#endif
+#include "ToolArena.h"
+
+// Source locations of the CSI ids, resolved once per unit in __csi_unit_init, so that the
+// hooks look them up with an array index instead of going through the CSI front-end data
+// tables. CSI numbers the ids of each kind globally, unit after unit: a unit's ids follow
+// those of the units initialized before it.
+//
+// Units are initialized by static constructors, before main. A unit loaded later (dlopen)
+// grows the tables while the program may be running, so it must not be instrumented.
+class CSIMetadata {
+public:
+    struct SourceLocation {
+        char* name;
+        int32_t line;
+    };
+
+    static constexpr csi_id_t NO_FUNC = -1;
+
+    // Sites that start strands (USE_SPAWN_SITES): the id of the detach or sync, and how the
+    // strand starts there. Site 0 is the start of the program.
+    enum SiteKind : uint32_t {
+        SITE_START,
+        SITE_SPAWN,        // The spawned task.
+        SITE_CONTINUATION, // The continuation of the spawn.
+        SITE_SYNC,
+    };
+
+    static uint32_t MakeSite(SiteKind kind, csi_id_t id) { return (uint32_t)id << 2 | kind; }
+    static SiteKind GetSiteKind(uint32_t site) { return (SiteKind)(site & 3); }
+
+    constexpr CSIMetadata() :
+        numFuncs(0), mainFuncId(NO_FUNC), funcLocations{ nullptr, 0 }, detachLocations{ nullptr, 0 }, taskExitLocations{ nullptr, 0 }, syncLocations{ nullptr, 0 } {}
+
+    // Resolve the ids of a unit that was just added to the CSI tables.
+    void AddUnit(const instrumentation_counts_t& counts) {
+        csi_id_t firstFunc = numFuncs;
+        numFuncs += counts.num_func;
+        for (csi_id_t funcId = firstFunc; funcId < numFuncs && mainFuncId == NO_FUNC; ++funcId)
+        {
+            char* name = __csi_get_func_source_loc(funcId)->name;
+            if (name != nullptr && strcmp(name, "main") == 0)
+                mainFuncId = funcId;
+        }
+
+        AddLocations(funcLocations, counts.num_func, __csi_get_func_source_loc);
+        AddLocations(detachLocations, counts.num_detach, __csi_get_detach_source_loc);
+        AddLocations(taskExitLocations, counts.num_task_exit, __csi_get_task_exit_source_loc);
+        AddLocations(syncLocations, counts.num_sync, __csi_get_sync_source_loc);
+    }
+
+    bool IsMain(csi_id_t funcId) const { return funcId == mainFuncId; }
+
+    const SourceLocation& GetFunc(csi_id_t funcId) const { return Get(funcLocations, funcId); }
+    const SourceLocation& GetDetach(csi_id_t detachId) const { return Get(detachLocations, detachId); }
+    const SourceLocation& GetTaskExit(csi_id_t taskExitId) const { return Get(taskExitLocations, taskExitId); }
+    const SourceLocation& GetSync(csi_id_t syncId) const { return Get(syncLocations, syncId); }
+
+    const SourceLocation& GetSite(uint32_t site) const {
+        csi_id_t id = site >> 2;
+        switch (GetSiteKind(site))
+        {
+        case SITE_SPAWN:
+        case SITE_CONTINUATION:
+            return GetDetach(id);
+        case SITE_SYNC:
+            return GetSync(id);
+        case SITE_START:
+        default:
+            return Unknown();
+        }
+    }
+
+private:
+    // Plain arrays, so that the tables can be constant-initialized: CSI initializes the
+    // units from constructors that may run before those of the tool.
+    struct LocationTable {
+        SourceLocation* entries;
+        csi_id_t size;
+    };
+
+    static void AddLocations(LocationTable& table, csi_id_t count, const source_loc_t* (*getSourceLoc)(const csi_id_t)) {
+        if (count <= 0)
+            return;
+
+        SourceLocation* entries = ToolNewArray<SourceLocation>(table.size + count);
+        if (table.size > 0)
+            memcpy(entries, table.entries, table.size * sizeof(SourceLocation));
+
+        for (csi_id_t id = table.size; id < table.size + count; ++id)
+        {
+            const source_loc_t* location = getSourceLoc(id);
+            if (location != nullptr)
+                entries[id] = { location->name, location->line_number };
+        }
+
+        ToolDeleteArray(table.entries, table.size);
+        table.entries = entries;
+        table.size += count;
+    }
+
+    // Ids out of range (such as CSI's unknown id) have no location.
+    static const SourceLocation& Get(const LocationTable& table, csi_id_t id) {
+        return (uint64_t)id < (uint64_t)table.size ? table.entries[id] : Unknown();
+    }
+
+    static const SourceLocation& Unknown() {
+        static const SourceLocation unknown = { nullptr, 0 };
+        return unknown;
+    }
+
+    csi_id_t numFuncs;
+    csi_id_t mainFuncId;
+
+    LocationTable funcLocations;
+    LocationTable detachLocations;
+    LocationTable taskExitLocations;
+    LocationTable syncLocations;
+};
+
+// Defined in hooks.cpp, constant-initialized.
+extern CSIMetadata csiMetadata;
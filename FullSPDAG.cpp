@@ -45,9 +45,9 @@ void FullSPDAG::Spawn(SPEdgeData & currentEdge, size_t regionId) {
         DEBUG_ASSERT(parentLevel->functionLevels.size() == 0 ||
             parentLevel->functionLevels.back() <= currentLevel);
 
-        // Check if we are still at the same level in the
-        // function stack. If we're not, we will need an 
-        // additional sync node.
+        // Check if we are still in the frame of the innermost
+        // sync block (same region). If we're not, we will need
+        // an additional sync node.
         if (parentLevel->functionLevels.size() == 0 ||
             parentLevel->functionLevels.back() < currentLevel ||
             parentLevel->regionIds.back() != regionId)
@@ -81,6 +81,7 @@ void FullSPDAG::Sync(SPEdgeData & currentEdge, size_t regionId) {
 
     if (nodes.size() == 0)
     {
+        serialEdge = currentEdge;
         isComplete = true;
         return;
     }
@@ -153,7 +154,7 @@ void FullSPDAG::Sync(SPEdgeData & currentEdge, size_t regionId) {
 
 SPComponent FullSPDAG::AggregateComponents(SPEdgeProducer* edgeProducer, SPEventBareboneOnlineProducer* eventProducer, int64_t threshold) {
     if (IsComplete() && firstNode == nullptr)
-        return SPComponent();
+        return SPComponent(serialEdge);
 
     DEBUG_ASSERT(firstNode != nullptr);
 
@@ -181,7 +182,7 @@ SPComponent FullSPDAG::AggregateComponents(SPEdgeProducer* edgeProducer, SPEvent
 
 SPComponent FullSPDAG::AggregateComponentsEfficient(SPEdgeProducer * edgeProducer, SPEventBareboneOnlineProducer* eventProducer, int64_t threshold) {
     if (IsComplete() && firstNode == nullptr)
-        return SPComponent();
+        return SPComponent(serialEdge);
 
     DEBUG_ASSERT(firstNode != nullptr);
 
@@ -208,7 +209,7 @@ SPComponent FullSPDAG::AggregateComponentsEfficient(SPEdgeProducer * edgeProduce
 
 SPNaiveComponent FullSPDAG::AggregateComponentsNaive(SPEdgeProducer* edgeProducer, SPEventBareboneOnlineProducer* eventProducer, int64_t threshold, size_t p) {
     if (IsComplete() && firstNode == nullptr)
-        return SPNaiveComponent(SPEdgeData(), 8);
+        return SPNaiveComponent(serialEdge, p);
 
     DEBUG_ASSERT(firstNode != nullptr);
 
@@ -236,7 +237,7 @@ SPNaiveComponent FullSPDAG::AggregateComponentsNaive(SPEdgeProducer* edgeProduce
 
 SPNaiveComponent FullSPDAG::AggregateComponentsNaiveEfficient(SPEdgeProducer * edgeProducer, SPEventBareboneOnlineProducer * eventProducer, int64_t threshold, size_t p) {
     if (IsComplete() && firstNode == nullptr)
-        return SPNaiveComponent(SPEdgeData(), 8);
+        return SPNaiveComponent(serialEdge, p);
 
     DEBUG_ASSERT(firstNode != nullptr);
 
@@ -0,0 +1,252 @@
+#pragma once
+#include <fstream>
+#include <string>
+#include <algorithm>
+#include "SeriesParallelDAG.h"
+#include "SPStrandLog.h"
+#include "CSIMetadata.h"
+
+// Per-function profile (USE_FUNC_PROFILE): for every function, its calls, the bytes it
+// allocated (with and without its callees), the peak it reached in a serial execution and the
+// high-water mark of its subtree on p processors, relative to its entry.
+//
+// The profile records of the strand logs are gathered in serial order as the logs are
+// replayed, and evaluated once tracking stops: the naive components (SPNaiveComponent) of the
+// segments between records are combined like the DAG does, following the spawns and syncs,
+// and each call gets the component of the segments between its entry and its exit. It runs
+// after the aggregation, which shares the pool of the components.
+class FunctionProfile {
+public:
+    // Called with the replay mutex held, in serial order.
+    void AddRecords(const ToolVector<SPProfileRecord>& records) {
+        trace.insert(trace.end(), records.begin(), records.end());
+    }
+
+    // Write the table of the functions to 'path'.tsv (sorted by high-water mark on p
+    // processors) and the bytes they allocated, by call path, to 'path'.folded.
+    void Write(const std::string& path, size_t p) {
+        Evaluate(p);
+
+        ToolVector<const FunctionStats*> sorted;
+        for (const auto& keyVal : functions)
+            sorted.push_back(&keyVal.second);
+
+        std::sort(sorted.begin(), sorted.end(), [](const FunctionStats* f1, const FunctionStats* f2) {
+            return f1->peak != f2->peak ? f1->peak > f2->peak : f1->serialPeak > f2->serialPeak;
+        });
+
+        std::ofstream table{ path + ".tsv" };
+        table << "function\tline\tcalls\tbytes\tself bytes\tpeak (p = 1)\tpeak (p = " << p << ")\n";
+        for (const FunctionStats* stats : sorted)
+        {
+            if (stats->calls == 0)
+                continue;
+
+            table << GetFunctionName(stats->funcId) << "\t" << csiMetadata.GetFunc(stats->funcId).line << "\t"
+                << stats->calls << "\t" << stats->bytes << "\t" << stats->selfBytes << "\t"
+                << stats->serialPeak << "\t" << stats->peak << "\n";
+        }
+
+        // Collapsed stacks, as read by flamegraph.pl.
+        std::ofstream folded{ path + ".folded" };
+        for (size_t node = 1; node < callTree.size(); ++node)
+        {
+            if (callTree[node].selfBytes > 0)
+                folded << GetPathName(node) << " " << callTree[node].selfBytes << "\n";
+        }
+    }
+
+    void Clear() {
+        trace.clear();
+        functions.clear();
+        callTree.clear();
+        callTreeChildren.clear();
+    }
+
+private:
+    struct FunctionStats {
+        csi_id_t funcId = 0;
+        size_t calls = 0;
+        // Bytes allocated by the outermost calls (recursive calls are part of them).
+        int64_t bytes = 0;
+        int64_t selfBytes = 0;
+        int64_t serialPeak = 0;
+        int64_t peak = 0;
+        // Calls of the function that are on the serial call stack.
+        size_t active = 0;
+    };
+
+    // A call path: the path of its parent and a function.
+    struct CallTreeNode {
+        size_t parent;
+        csi_id_t funcId;
+        int64_t selfBytes;
+    };
+
+    enum FrameKind { FRAME_CALL, FRAME_SPAWN, FRAME_CHILD };
+
+    // The replay keeps a stack of the components that are waiting for the current one: those
+    // of the callers before their calls, of the continuations before their spawns, and of the
+    // spawned children that completed before the sync of their spawns.
+    struct Frame {
+        FrameKind kind;
+        // Function id for calls, region id of the spawn otherwise.
+        uint64_t id;
+        SPNaiveComponent component;
+        size_t node;
+        int64_t bytesAtEntry;
+        int64_t calleeBytes;
+
+        Frame(FrameKind kind, uint64_t id, SPNaiveComponent&& component, size_t node, int64_t bytesAtEntry) :
+            kind(kind), id(id), component(std::move(component)), node(node), bytesAtEntry(bytesAtEntry), calleeBytes(0) {}
+    };
+
+    void Evaluate(size_t p) {
+        functions.clear();
+        callTree.clear();
+        callTreeChildren.clear();
+        callTree.push_back({ 0, CSIMetadata::NO_FUNC, 0 });
+
+        ToolVector<Frame> stack;
+        SPNaiveComponent current{ p };
+        size_t node = 0;
+
+        // Memory of the current strand at the previous record, and bytes allocated so far.
+        int64_t strandMem = 0;
+        int64_t strandBytes = 0;
+        int64_t bytes = 0;
+
+        for (const SPProfileRecord& record : trace)
+        {
+            SPEdgeData segment;
+            segment.memAllocated = record.memAllocated - strandMem;
+            segment.maxMemAllocated = record.maxMemAllocated - strandMem;
+            current.CombineSeries(SPNaiveComponent{ segment, p });
+
+            bytes += record.bytesAllocated - strandBytes;
+            strandMem = record.memAllocated;
+            strandBytes = record.bytesAllocated;
+
+            switch (record.kind)
+            {
+            case PROFILE_ENTRY:
+            {
+                size_t callee = GetCallTreeNode(node, record.id);
+                stack.emplace_back(FRAME_CALL, record.id, std::move(current), node, bytes);
+                current = SPNaiveComponent{ p };
+                node = callee;
+
+                FunctionStats& stats = functions[record.id];
+                stats.funcId = record.id;
+                stats.active++;
+                break;
+            }
+
+            case PROFILE_EXIT:
+            {
+                // Calls that were entered before tracking started have no frame.
+                if (stack.empty() || stack.back().kind != FRAME_CALL || stack.back().id != record.id)
+                    break;
+
+                Frame& frame = stack.back();
+                int64_t callBytes = bytes - frame.bytesAtEntry;
+
+                FunctionStats& stats = functions[record.id];
+                stats.calls++;
+                stats.selfBytes += callBytes - frame.calleeBytes;
+                stats.serialPeak = std::max(stats.serialPeak, current.GetWatermark(1));
+                stats.peak = std::max(stats.peak, current.GetWatermark(p));
+                if (--stats.active == 0)
+                    stats.bytes += callBytes;
+
+                callTree[node].selfBytes += callBytes - frame.calleeBytes;
+                node = frame.node;
+
+                frame.component.CombineSeries(current);
+                current = std::move(frame.component);
+                stack.pop_back();
+
+                for (auto it = stack.rbegin(); it != stack.rend(); ++it)
+                {
+                    if (it->kind == FRAME_CALL)
+                    {
+                        it->calleeBytes += callBytes;
+                        break;
+                    }
+                }
+                break;
+            }
+
+            case PROFILE_SPAWN:
+                stack.emplace_back(FRAME_SPAWN, record.id, std::move(current), node, bytes);
+                current = SPNaiveComponent{ p };
+                break;
+
+            case PROFILE_SYNC:
+                if (record.id == 0)
+                {
+                    // Task exit: the spawned child waits for the sync of its spawn. The last
+                    // strand of the window, or of a task spawned before it, has no spawn frame.
+                    if (!stack.empty() && stack.back().kind == FRAME_SPAWN)
+                    {
+                        uint64_t regionId = stack.back().id;
+                        stack.emplace_back(FRAME_CHILD, regionId, std::move(current), node, bytes);
+                        current = SPNaiveComponent{ p };
+                    }
+                    break;
+                }
+
+                // s0 spawn c1 s1 spawn c2 s2 sync is s0 (c1 || s1 (c2 || s2)).
+                while (stack.size() >= 2 && stack.back().kind == FRAME_CHILD && stack.back().id == record.id)
+                {
+                    stack.back().component.CombineParallel(current);
+                    current = std::move(stack.back().component);
+                    stack.pop_back();
+
+                    stack.back().component.CombineSeries(current);
+                    current = std::move(stack.back().component);
+                    stack.pop_back();
+                }
+                break;
+            }
+
+            // The next record belongs to the next strand.
+            if (record.kind == PROFILE_SPAWN || record.kind == PROFILE_SYNC)
+            {
+                strandMem = 0;
+                strandBytes = 0;
+            }
+        }
+
+        trace.clear();
+    }
+
+    size_t GetCallTreeNode(size_t parent, csi_id_t funcId) {
+        auto key = std::make_pair(parent, funcId);
+        auto it = callTreeChildren.find(key);
+        if (it != callTreeChildren.end())
+            return it->second;
+
+        callTree.push_back({ parent, funcId, 0 });
+        callTreeChildren[key] = callTree.size() - 1;
+        return callTree.size() - 1;
+    }
+
+    static std::string GetFunctionName(csi_id_t funcId) {
+        const CSIMetadata::SourceLocation& location = csiMetadata.GetFunc(funcId);
+        return location.name != nullptr ? location.name : "??";
+    }
+
+    std::string GetPathName(size_t node) {
+        std::string name = GetFunctionName(callTree[node].funcId);
+        for (node = callTree[node].parent; node != 0; node = callTree[node].parent)
+            name = GetFunctionName(callTree[node].funcId) + ";" + name;
+        return name;
+    }
+
+    ToolVector<SPProfileRecord> trace;
+
+    ToolMap<csi_id_t, FunctionStats> functions;
+    ToolVector<CallTreeNode> callTree;
+    ToolMap<std::pair<size_t, csi_id_t>, size_t> callTreeChildren;
+};
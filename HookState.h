@@ -0,0 +1,53 @@
+#pragma once
+#include <stdint.h>
+
+struct SPStrandLog;
+
+constexpr uint32_t HOOK_TRACKED = 1;
+constexpr uint32_t HOOK_IN_INSTRUMENTATION = 2;
+// Resident mode (MHWM_Resident): strands are charged the change of the resident set
+// at spawns and syncs, so the allocation hooks don't account anything.
+constexpr uint32_t HOOK_RESIDENT = 4;
+constexpr uint32_t HOOK_REENTRANCY_SHIFT = 3;
+constexpr uint32_t HOOK_REENTRANCY_UNIT = 1 << HOOK_REENTRANCY_SHIFT;
+
+// Per-thread state of the allocation hooks. The flags are packed into a single word
+// so that malloc/free can tell whether to account an allocation with one comparison:
+// only a tracked thread that is neither inside the tool nor reentrant is accounted.
+struct HookState {
+    // HOOK_TRACKED | HOOK_IN_INSTRUMENTATION | HOOK_RESIDENT | (reentrancy depth << HOOK_REENTRANCY_SHIFT)
+    uint32_t flags;
+
+    // Strand log the thread is recording into (nullptr if the thread is not
+    // executing the instrumented program).
+    SPStrandLog* log;
+
+    // Allocation sampler (MHWM_SampleRate): bytes left before the next sample point
+    // (0 until the first gap is drawn) and the state of the thread's random generator.
+    int64_t bytesUntilSample;
+    uint64_t randomState;
+
+    // Chunk of the allocation recording (MHWM_RecordFile) the thread is filling.
+    uint64_t recordNext;
+    uint64_t recordEnd;
+
+    bool IsAccounting() const { return flags == HOOK_TRACKED; }
+    bool IsReentrant() const { return flags >= HOOK_REENTRANCY_UNIT; }
+
+    void SetLog(SPStrandLog* newLog) {
+        log = newLog;
+        if (newLog != nullptr)
+            flags |= HOOK_TRACKED;
+        else
+            flags &= ~HOOK_TRACKED;
+    }
+
+    void EnterInstrumentation() { flags |= HOOK_IN_INSTRUMENTATION; }
+    void ExitInstrumentation() { flags &= ~HOOK_IN_INSTRUMENTATION; }
+
+    void EnterReentrant() { flags += HOOK_REENTRANCY_UNIT; }
+    void ExitReentrant() { flags -= HOOK_REENTRANCY_UNIT; }
+};
+
+// Defined in memoryhook.so. Initial-exec keeps every access a single %fs-relative load.
+extern __thread HookState hookState __attribute__((tls_model("initial-exec")));
@@ -0,0 +1,89 @@
+#include <stdlib.h>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "SPStrandLog.h"
+#include "HookState.h"
+
+// Microbenchmark of the allocation hooks in memoryhook.so: reports the cost of
+// a malloc/free pair on a thread that is not tracked and on one that is
+// recording into a strand log, of a new/delete pair on the latter, and the
+// metadata kept per live allocation.
+//   [MHWM_Allocator=...] ./mallocbench [pairs] [size] [live]
+
+bool started = true;
+size_t minSizeBacktrace = 10 * 1000 * 1000;
+size_t sampleRate = 0;
+size_t stackDepth = 1;
+std::string programName = "";
+
+extern "C" void GetAllocationTableStats(size_t* liveEntries, size_t* reservedBytes);
+extern "C" const char* GetAllocatorName();
+
+double TimePairs(size_t pairs, size_t size) {
+    auto start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < pairs; ++i)
+    {
+        void* volatile mem = malloc(size);
+        free(mem);
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / pairs;
+}
+
+double TimeNewDeletePairs(size_t pairs, size_t size) {
+    auto start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < pairs; ++i)
+    {
+        void* volatile mem = ::operator new(size);
+#ifdef __cpp_sized_deallocation
+        ::operator delete(mem, size);
+#else
+        ::operator delete(mem);
+#endif
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / pairs;
+}
+
+int main(int argc, char** argv) {
+    size_t pairs = argc > 1 ? std::atoll(argv[1]) : 10 * 1000 * 1000;
+    size_t size = argc > 2 ? std::atoll(argv[2]) : 64;
+    size_t live = argc > 3 ? std::atoll(argv[3]) : 1000 * 1000;
+
+    TimePairs(pairs / 10, size); // Warm up.
+
+    double untracked = TimePairs(pairs, size);
+
+    SPStrandLog log;
+    hookState.SetLog(&log);
+    double tracked = TimePairs(pairs, size);
+    double trackedNew = TimeNewDeletePairs(pairs, size);
+    hookState.SetLog(nullptr);
+
+    std::cout << "Allocator: " << GetAllocatorName() << "\n";
+    std::cout << "malloc/free pair (" << size << " bytes), untracked thread: " << untracked << " ns\n";
+    std::cout << "malloc/free pair (" << size << " bytes), tracked thread: " << tracked << " ns\n";
+    std::cout << "new/delete pair (" << size << " bytes), tracked thread: " << trackedNew << " ns\n";
+
+    std::vector<void*> blocks(live);
+    for (auto& block : blocks)
+        block = malloc(size);
+
+    size_t liveEntries = 0;
+    size_t reservedBytes = 0;
+    GetAllocationTableStats(&liveEntries, &reservedBytes);
+    if (liveEntries > 0)
+        std::cout << "Metadata for " << liveEntries << " live allocations: " << reservedBytes << " bytes ("
+        << (double)reservedBytes / liveEntries << " bytes per allocation)\n";
+
+    for (auto& block : blocks)
+        free(block);
+
+    return 0;
+}
@@ -1,18 +1,55 @@
-#include <stddef.h>
-#include <stdlib.h>
-#include <iostream>
-#include <cstring>
-#include "hooks.h"
-#include <malloc.h>
-
-
-bool reentrant = false;
-
-extern std::string programName;
-
-#ifdef USE_BACKTRACE
+#include <stddef.h>
+#include <stdlib.h>
+#include <iostream>
+#include <cstring>
+#include "hooks.h"
+#include "AllocationTable.h"
+#include "AllocatorBackend.h"
+#include "ToolArena.h"
+#include "AllocationRecorder.h"
+#include "AllocatorModel.h"
+#include <malloc.h>
+#include <mutex>
+#include <cmath>
+#include <cerrno>
+#include <new>
+#include <map>
+#include <atomic>
+#include <algorithm>
+#include <cstdarg>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+
+
+extern std::string programName;
+
+// Memory of the tool's own data structures. Constant-initialized, so the tool can
+// allocate before static constructors run.
+ToolArena toolArena;
+
+// Recording of the allocation stream (MHWM_RecordFile), opened by the tool at program start.
+AllocationRecorder allocationRecorder;
+
+// Allocator footprint model (MHWM_AllocatorModel), selected by the tool at program start.
+AllocatorModel allocatorModel;
+
+// Number of times the program unmapped memory, which may have held a stack (see FindStack).
+static std::atomic<uint64_t> numUnmaps{ 0 };
+
+#if defined(USE_PAYLOAD) || defined(USE_BACKTRACE)
+// Size (USE_PAYLOAD) and source (USE_BACKTRACE) of the live allocations.
+// Constant-initialized, so it can be used before static constructors run.
+static AllocationTable allocationTable;
+#endif
+
+#ifdef USE_BACKTRACE
 #include "backtrace.h"
 #include "backtrace-supported.h"
+#include "StackDepot.h"
+#include <unwind.h>
 
 
 
@@ -54,15 +91,15 @@ static int full_callback(void* data, uintptr_t pc, const char* filename, int lin
     }
 
 
-    if (true && filename != nullptr && ((programName.size() > 0 && strstr(filename, programName.c_str()) != NULL) || strstr(filename, "./") == filename) && strstr(filename, "MemoryHook") == NULL)
-    {
-        //  printf("HERE\n");
-        if (function != nullptr)
-            ctx->function = function;
-        ctx->filename = filename;
-        ctx->line = lineno;
-
-        return 1;
+    if (true && filename != nullptr && ((programName.size() > 0 && strstr(filename, programName.c_str()) != NULL) || strstr(filename, "./") == filename) && strstr(filename, "MemoryHook") == NULL)
+    {
+        //  printf("HERE\n");
+        if (function != nullptr)
+            ctx->function = function;
+        ctx->filename = filename;
+        ctx->line = lineno;
+
+        return 1;
     }
 
     return 0;
@@ -78,319 +115,887 @@ static int simple_callback(void* data, uintptr_t pc) {
 
 struct backtrace_state* state = nullptr;
 
-std::unordered_map<void*, std::string> addrToSource;
+// Number of program frames in the attributed stacks (MHWM_StackDepth).
+extern "C" size_t stackDepth;
+
+// Source locations ("file:line") of the program frames that have been symbolized.
+// Index 0 is unused, so that a location id is never 0.
+ToolVector<std::string> locationNames{ "" };
+ToolUnorderedMap<std::string, uint32_t> locationIds;
+
+// Call stacks of the attributed allocations, made of location ids. The source maps
+// and the allocation table only store stack ids (0 means no source).
+StackDepot stackDepot;
+
+// Protects the libbacktrace state, the source locations and the stack depot, which are shared by all workers.
+std::mutex btMutex;
+
+static uint32_t InternLocation(const std::string& location) {
+    auto it = locationIds.find(location);
+    if (it != locationIds.end())
+        return it->second;
 
-static inline void bt_inner(SPEdgeData & data, size_t size, bool newMax = false, void* addr = nullptr) {
+    uint32_t id = (uint32_t)locationNames.size();
+    locationNames.push_back(location);
+    locationIds[location] = id;
+    return id;
+}
+
+// Location id of each return address that has been symbolized (0 if it isn't in the
+// program). Every distinct PC goes through libbacktrace's DWARF lookup only once.
+ToolUnorderedMap<uintptr_t, uint32_t> pcLocations;
+
+static constexpr int MAX_FRAMES = 64;
 
-    if (state == nullptr)
-        state = backtrace_create_state(nullptr, 0, error_callback, nullptr);
-    struct bt_ctx ctx = { state };
-    ctx.allocSize = size;
-    backtrace_full(state, 0, full_callback, error_callback, &ctx);
+// Bounds of the calling thread's stack, queried on its first backtrace (stackHigh == 0 until then).
+static __thread uintptr_t stackLow __attribute__((tls_model("initial-exec"))) = 0;
+static __thread uintptr_t stackHigh __attribute__((tls_model("initial-exec"))) = 0;
 
-    if (ctx.function != "")
+static void QueryStackBounds() {
+    // Empty bounds if they are unknown. pthread_getattr_np allocates: bt runs it with the hooks reentrant.
+    uintptr_t low = 1, high = 1;
+
+    pthread_attr_t attr;
+    if (pthread_getattr_np(pthread_self(), &attr) == 0)
     {
-        //printf("[%zu] --> %s %s:%d\n", ctx.allocSize, ctx.function.c_str(), ctx.filename != "" ? ctx.filename.c_str() : "??", ctx.line);
-        std::string sourceLoc = std::string(ctx.filename) + ":" + std::to_string(ctx.line);
-        DEBUG_ASSERT(data.allocMap);
-        DEBUG_ASSERT(data.maxAllocMap);
-        (*(data.allocMap))[sourceLoc] += size;
-        //std::cout << "Current memory for " << sourceLoc << ": " << (*(data.allocMap))[sourceLoc] << "\n";
-        if (newMax) {
-            *(data.maxAllocMap) = *(data.allocMap);
-            data.maxAllocMapSize = data.maxMemAllocated;
+        void* addr;
+        size_t size;
+        if (pthread_attr_getstack(&attr, &addr, &size) == 0 && size != 0)
+        {
+            low = (uintptr_t)addr;
+            high = low + size;
         }
+        pthread_attr_destroy(&attr);
+    }
+
+    stackLow = low;
+    stackHigh = high;
+}
+
+struct StackRange {
+    uintptr_t low;
+    uintptr_t high;
+};
+
+// Readable mappings outside the thread's stack that its walks went through (the stacks the
+// runtime switches to, Cilk's fibers), forgotten when the program unmaps memory.
+static constexpr int NUM_FIBER_STACKS = 8;
+static __thread StackRange fiberStacks[NUM_FIBER_STACKS] __attribute__((tls_model("initial-exec")));
+static __thread int nextFiberStack __attribute__((tls_model("initial-exec"))) = 0;
+static __thread uint64_t fiberStacksUnmaps __attribute__((tls_model("initial-exec"))) = 0;
+
+// Find the readable mapping that contains 'address' in /proc/self/maps, without allocating.
+static bool FindReadableMapping(uintptr_t address, StackRange& range) {
+    int fd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    // Lines start with "start-end perms": parse them as they come, across reads.
+    char buffer[4096];
+    uintptr_t start = 0, end = 0;
+    int field = 0; // 0: start, 1: end, 2: permissions, 3: rest of the line.
+    bool found = false, done = false;
+    ssize_t length;
+
+    while (!done && (length = read(fd, buffer, sizeof(buffer))) > 0)
+    {
+        for (ssize_t i = 0; i < length && !done; ++i)
+        {
+            char c = buffer[i];
+            if (c == '\n')
+            {
+                start = end = 0;
+                field = 0;
+            }
+            else if (field == 0 || field == 1)
+            {
+                if (c == '-' || c == ' ')
+                    field++;
+                else
+                {
+                    uintptr_t digit = c <= '9' ? c - '0' : c - 'a' + 10;
+                    (field == 0 ? start : end) = (field == 0 ? start : end) * 16 + digit;
+                }
+            }
+            else if (field == 2)
+            {
+                // The mappings are sorted.
+                if (address >= start && address < end)
+                {
+                    found = c == 'r';
+                    range = { start, end };
+                }
+                done = address < end;
+                field = 3;
+            }
+        }
+    }
+
+    close(fd);
+    return found;
+}
+
+// Find the stack that contains 'address': the thread's, or a readable mapping around it.
+static bool FindStack(uintptr_t address, StackRange& range) {
+    if (address >= stackLow && address < stackHigh)
+    {
+        range = { stackLow, stackHigh };
+        return true;
+    }
+
+    uint64_t unmaps = numUnmaps.load(std::memory_order_relaxed);
+    if (fiberStacksUnmaps != unmaps)
+    {
+        for (StackRange& fiberStack : fiberStacks)
+            fiberStack = { 0, 0 };
+        fiberStacksUnmaps = unmaps;
+    }
+
+    for (const StackRange& fiberStack : fiberStacks)
+    {
+        if (address >= fiberStack.low && address < fiberStack.high)
+        {
+            range = fiberStack;
+            return true;
+        }
+    }
+
+    if (!FindReadableMapping(address, range))
+        return false;
+
+    fiberStacks[nextFiberStack] = range;
+    nextFiberStack = (nextFiberStack + 1) % NUM_FIBER_STACKS;
+    return true;
+}
+
+// Capture the return addresses of the calling thread by walking the frame-pointer chain.
+// It stops at the first frame that doesn't look like one (code built without frame pointers),
+// and never reads outside the stack that holds the frame: the thread's, or on the stacks the
+// runtime switches to (Cilk's fibers), the mapping that contains it.
+__attribute__((noinline)) static int UnwindFramePointers(uintptr_t* pcs, int maxFrames) {
+    if (stackHigh == 0)
+        QueryStackBounds();
+
+    uintptr_t* fp = (uintptr_t*)__builtin_frame_address(0);
+    StackRange stack;
+    if (!FindStack((uintptr_t)fp, stack))
+        return 0;
+
+    int numFrames = 0;
+
+    while (numFrames < maxFrames)
+    {
+        uintptr_t pc = fp[1];
+        if (pc == 0)
+            break;
+        pcs[numFrames++] = pc;
+
+        uintptr_t* next = (uintptr_t*)fp[0];
+        if (next <= fp || ((uintptr_t)next & (sizeof(uintptr_t) - 1)) != 0)
+            break;
+        if ((uintptr_t)(next + 2) > stack.high && !(FindStack((uintptr_t)next, stack) && (uintptr_t)(next + 2) <= stack.high))
+            break;
+        fp = next;
+    }
+
+    return numFrames;
+}
+
+struct UnwindCtx {
+    uintptr_t* pcs;
+    int numFrames;
+    int maxFrames;
+};
+
+static _Unwind_Reason_Code UnwindCallback(struct _Unwind_Context* context, void* data) {
+    UnwindCtx* ctx = (UnwindCtx*)data;
+    if (ctx->numFrames == ctx->maxFrames)
+        return _URC_END_OF_STACK;
+
+    uintptr_t pc = _Unwind_GetIP(context);
+    if (pc == 0)
+        return _URC_END_OF_STACK;
+
+    ctx->pcs[ctx->numFrames++] = pc;
+    return _URC_NO_REASON;
+}
+
+// Fallback for stacks the frame-pointer walk can't see through. libgcc's unwinder
+// caches the .eh_frame lookups of the objects it has already unwound through.
+static int UnwindEhFrame(uintptr_t* pcs, int maxFrames) {
+    UnwindCtx ctx = { pcs, 0, maxFrames };
+    _Unwind_Backtrace(UnwindCallback, &ctx);
+    return ctx.numFrames;
+}
+
+// Collect the location ids of the innermost 'maxLocations' program frames among 'pcs'.
+// Returns how many were found. Must hold btMutex.
+static int FindLocations(const uintptr_t* pcs, int numFrames, uint32_t* locations, int maxLocations) {
+    int numLocations = 0;
+
+    for (int i = 0; i < numFrames && numLocations < maxLocations; ++i)
+    {
+        auto it = pcLocations.find(pcs[i]);
+        if (it == pcLocations.end())
+        {
+            if (state == nullptr)
+                state = backtrace_create_state(nullptr, 0, error_callback, nullptr);
+
+            // Return addresses point after the call: look up the call instruction.
+            struct bt_ctx ctx = { state };
+            backtrace_pcinfo(state, pcs[i] - 1, full_callback, error_callback, &ctx);
+
+            uint32_t locationId = 0;
+            if (ctx.function != "")
+                locationId = InternLocation(ctx.filename + ":" + std::to_string(ctx.line));
+            it = pcLocations.emplace(pcs[i], locationId).first;
+        }
+
+        if (it->second != 0)
+            locations[numLocations++] = it->second;
+    }
+
+    return numLocations;
+}
+
+// Returns the stack id of the allocation, or 0 if no source was found.
+static inline uint32_t bt_inner(SPEdgeData & data, size_t size, bool newMax = false) {
+    uintptr_t pcs[MAX_FRAMES];
+    int numFrames = UnwindFramePointers(pcs, MAX_FRAMES);
+
+    uint32_t locations[MAX_FRAMES];
+    int maxLocations = stackDepth < (size_t)MAX_FRAMES ? (int)stackDepth : MAX_FRAMES;
+
+    std::unique_lock<std::mutex> lock(btMutex);
+    int numLocations = FindLocations(pcs, numFrames, locations, maxLocations);
+
+    if (numLocations == 0)
+    {
+        lock.unlock();
+        numFrames = UnwindEhFrame(pcs, MAX_FRAMES);
+        lock.lock();
+
+        numLocations = FindLocations(pcs, numFrames, locations, maxLocations);
+        if (numLocations == 0)
+            return 0;
+    }
+
+    // Intern the stack from its outermost frame.
+    uint32_t stackId = 0;
+    for (int i = numLocations - 1; i >= 0; --i)
+        stackId = stackDepot.Push(stackId, locations[i]);
+
+    lock.unlock();
+
+    DEBUG_ASSERT(data.allocMap);
+    DEBUG_ASSERT(data.maxAllocMap);
+
+    (*(data.allocMap))[stackId] += size;
+    if (newMax) {
+        *(data.maxAllocMap) = *(data.allocMap);
+        data.maxAllocMapSize = data.maxMemAllocated;
+    }
+
+    return stackId;
+}
+
+std::string GetStackName(uint32_t stackId) {
+    std::lock_guard<std::mutex> lock(btMutex);
+
+    std::string name;
+    for (; stackId != 0; stackId = stackDepot.GetCaller(stackId))
+    {
+        if (!name.empty())
+            name += " <- ";
+        name += locationNames[stackDepot.GetFrame(stackId)];
+    }
+
+    return name;
+}
+
+uint32_t GetNumStacks() {
+    std::lock_guard<std::mutex> lock(btMutex);
+    return stackDepot.GetNumStacks();
+}
+
+static inline uint32_t bt(SPEdgeData & data, size_t size, bool newMax = false) {
+    hookState.EnterReentrant();
+
+    uint32_t stackId = bt_inner(data, size, newMax);
+
+    hookState.ExitReentrant();
+
+    return stackId;
+}
 
-        addrToSource[addr] = sourceLoc; 
-        /* if (data.filename)
-             *(data.filename) = ctx.filename;
-         else
-             data.filename = new std::string(ctx.filename);
-         if (data.function)
-             *(data.function) = ctx.function;
-         else
-             data.function = new std::string(ctx.function);
-         data.line = (size_t)ctx.line; */
-    }
-
-}
-
-static inline void bt(SPEdgeData & data, size_t size, bool newMax = false, void* addr = nullptr) {
-    bool wasAlreadyReentrant = reentrant;
-
-    reentrant = true;
-
-    bt_inner(data, size, newMax, addr);
-
-    if (!wasAlreadyReentrant)
-        reentrant = false;
-}
-
-#endif
-
-extern "C" {
-    extern void* __libc_malloc(size_t);
-    extern void* __libc_free(void*);
-    extern void* __libc_realloc(void*, size_t);
-    extern void* __libc_memalign(size_t alignment, size_t size, const void* caller);
-}
-
-#define MAX_DEBUG_PTRS 5000
-void* ptrs[MAX_DEBUG_PTRS];
-size_t currentPtr = 0;
-
-extern uint32_t mainThread;
-
-uint32_t GetThreadId() {
-    auto id = std::this_thread::get_id();
-
-    uint32_t uid;
-    memcpy(&uid, &id, std::min(sizeof(id), sizeof(uid)));
-
-    return uid;
-}
-
-
-
-extern "C" {
-    extern bool started;
-    extern bool inInstrumentation;
-
-    extern SPEdgeData currentEdge;
-
-    extern size_t minSizeBacktrace;
-
-    static constexpr size_t PAYLOAD_BYTES = 64;
-    static constexpr bool debug = false;
-
-    size_t numAllocs = 0;
-    size_t numFrees = 0;
-
-    static size_t magicValue = 0xAABBCCDDEEFFAABB;
-
-    void* malloc(size_t size) {
-
-        // numAllocs++;
-
-        if (size == 0) // Treat zero-allocations as non-zero for sake of testing.
-            size = 1;
-
-#ifdef USE_PAYLOAD
-        uint8_t * mem = (uint8_t*)__libc_malloc(PAYLOAD_BYTES + size);
-#else
-        uint8_t * mem = (uint8_t*)__libc_malloc(size);
-        size = malloc_usable_size(mem);
 #endif
-        bool isMainThread = mainThread == 0 || (GetThreadId() == mainThread);
 
-        bool newMax = false;
+// Constant-initialized, so it can be used before static constructors run.
+static AllocatorBackend allocator;
+
+alignas(4096) char AllocatorBackend::bootstrapArena[AllocatorBackend::BOOTSTRAP_BYTES];
+std::atomic<size_t> AllocatorBackend::bootstrapUsed{ 0 };
+
+#define MAX_DEBUG_PTRS 5000
+void* ptrs[MAX_DEBUG_PTRS];
+size_t currentPtr = 0;
+
+// Allocations are charged to the strand the calling worker is executing.
+__thread HookState hookState __attribute__((tls_model("initial-exec"))) = { 0, nullptr, 0, 0, 0, 0 };
+
+extern "C" {
+    extern bool started;
+
+    extern size_t minSizeBacktrace;
+    extern size_t sampleRate;
+
+    static constexpr bool debug = false;
+
+#ifdef USE_BACKTRACE
+    // Byte sampling (MHWM_SampleRate), as in tcmalloc's heap profiler: every allocated
+    // byte is a sample point with probability 1/sampleRate, and an allocation is
+    // backtraced if it contains at least one. Sampled allocations are weighted by the
+    // inverse of their sampling probability, so the source maps stay unbiased.
+
+    static inline uint64_t NextRandom() {
+        uint64_t& x = hookState.randomState;
+        if (x == 0)
+            x = (((uint64_t)(uintptr_t)&hookState * 0x9e3779b97f4a7c15ULL) ^
+                (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count()) | 1;
+
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        return x;
+    }
+
+    // Distance to the next sample point: exponential with mean sampleRate.
+    static inline int64_t NextSampleGap() {
+        double u = ((NextRandom() >> 11) + 1) * (1.0 / (1ULL << 53)); // In (0, 1].
+        return (int64_t)(-std::log(u) * sampleRate) + 1;
+    }
+
+    static inline bool SampleAllocation(size_t size) {
+        int64_t before = hookState.bytesUntilSample;
+        hookState.bytesUntilSample = before - (int64_t)size;
+        if (hookState.bytesUntilSample > 0)
+            return false;
 
-        if (!reentrant && started && !inInstrumentation && isMainThread)
+        // First allocation of the thread: the gaps are memoryless, so drawing one now is unbiased.
+        if (before == 0)
         {
-            currentEdge.memAllocated += size;
-            //  GUARD_REENTRANT(printf("[malloc] addr: %p - size: %d - currentEdge.memAllocated: %d - currentEdge.maxMemAllocated: %d\n", mem, (int)size, (int)(currentEdge.memAllocated), (int)(currentEdge.maxMemAllocated)));
+            hookState.bytesUntilSample = NextSampleGap() - (int64_t)size;
+            if (hookState.bytesUntilSample > 0)
+                return false;
+        }
 
-            if (currentEdge.memAllocated > currentEdge.maxMemAllocated)
-            {
+        hookState.bytesUntilSample = NextSampleGap();
+        return true;
+    }
+
+    // Bytes charged to the source of an allocation: its size, or, when sampling,
+    // its size divided by the probability 1 - e^(-size/sampleRate) of sampling it.
+    static inline int64_t SourceWeight(size_t size) {
+        if (sampleRate == 0)
+            return size;
+        return (int64_t)(size / -std::expm1(-(double)size / sampleRate));
+    }
+#endif
+
+    // Charge 'size' bytes (possibly negative) to the current edge of the calling worker.
+    // Returns the stack id of the allocation, if it was backtraced.
+    static inline uint32_t AccountAllocation(int64_t size) {
+        SPEdgeData& currentEdge = hookState.log->currentEdge;
 
 #ifdef USE_BACKTRACE
-                if (currentEdge.memAllocated > 2 * currentEdge.maxAllocMapSize)
-                    newMax = true;
+        bool newMax = false;
 #endif
 
-                currentEdge.maxMemAllocated = currentEdge.memAllocated;
-            }
+        currentEdge.memAllocated += size;
+#ifdef USE_FUNC_PROFILE
+        currentEdge.bytesAllocated += size;
+#endif
+        //  GUARD_REENTRANT(printf("[malloc] size: %d - currentEdge.memAllocated: %d - currentEdge.maxMemAllocated: %d\n", (int)size, (int)(currentEdge.memAllocated), (int)(currentEdge.maxMemAllocated)));
 
+        if (currentEdge.memAllocated > currentEdge.maxMemAllocated)
+        {
+#ifdef USE_BACKTRACE
+            if (currentEdge.memAllocated > 2 * (int64_t)currentEdge.maxAllocMapSize)
+                newMax = true;
+#endif
 
-            // GUARD_REENTRANT(printf("currentEdge.memAllocated: %d\n", (int)(currentEdge.memAllocated)));
+            currentEdge.maxMemAllocated = currentEdge.memAllocated;
+        }
 
 #ifdef USE_BACKTRACE
-            if (!reentrant && size > minSizeBacktrace)
-            {
-                //  if (size > currentEdge.biggestAllocation)
-                {
-                    bt(currentEdge, size, newMax, mem);
-                    currentEdge.biggestAllocation = size;
+        if (sampleRate > 0)
+        {
+            if (size > 0 && SampleAllocation(size))
+                return bt(currentEdge, SourceWeight(size), newMax);
+        }
+        else if (size > (int64_t)minSizeBacktrace)
+        {
+            currentEdge.biggestAllocation = size;
+            return bt(currentEdge, size, newMax);
+        }
+#endif
 
-                }
-            }
+        return 0;
+    }
+
+    // Forget the metadata of 'mem', if any.
+    static inline bool TakeMetadata(void* mem, size_t& size, uint32_t& stackId) {
+        size = 0;
+        stackId = 0;
+
+#if defined(USE_PAYLOAD) || defined(USE_BACKTRACE)
+        uint32_t storedSize = 0;
+        if (!allocationTable.Take(mem, storedSize, stackId))
+            return false;
+
+        size = storedSize != AllocationTable::SIZE_UNKNOWN ? storedSize : allocator.UsableSize(mem);
+        return true;
+#else
+        return false;
 #endif
-        }
+    }
 
+    // Remove 'size' bytes of a freed block from the current edge.
+    static inline void AccountFree(size_t size, uint32_t stackId) {
+        SPEdgeData& currentEdge = hookState.log->currentEdge;
 
+        //GUARD_REENTRANT(printf("[free] size: %d - currentEdge.memAllocated: %d - currentEdge.maxMemAllocated: %d\n", (int)size, (int)(currentEdge.memAllocated), (int)(currentEdge.maxMemAllocated)));
 
+#ifdef USE_BACKTRACE
+        DEBUG_ASSERT_EXIT(currentEdge.allocMap);
 
+        if (stackId != 0)
+            GUARD_REENTRANT((*currentEdge.allocMap)[stackId] -= SourceWeight(size));
+#endif
 
+        currentEdge.memAllocated -= size;
+    }
 
-#ifdef USE_PAYLOAD
-        // Store the size of the allocation.
-        if (PAYLOAD_BYTES > 2 * sizeof(size_t))
+    // Bytes charged for a block of 'size' bytes: its footprint under the allocator model, if any.
+    static inline size_t ChargedSize(size_t size) {
+        return allocatorModel.IsActive() ? allocatorModel.Footprint(size) : size;
+    }
+
+    // Record an event charged to the current edge of the calling worker (MHWM_RecordFile).
+    // 'usableSize' is only used for allocations.
+    static __attribute__((noinline)) void RecordEvent(AllocationRecordOp op, void* mem, size_t size, size_t usableSize, uint32_t stackId) {
+        AllocationRecord record = {};
+        record.address = (uintptr_t)mem;
+        record.size = size;
+        record.edge = hookState.log->currentEdgeId;
+        record.stackId = stackId;
+        record.slack = usableSize > size ? (uint32_t)(usableSize - size) : 0;
+        record.op = op;
+
+        allocationRecorder.Append(hookState.recordNext, hookState.recordEnd, record);
+    }
+
+    // Account a block the allocator just returned for a request of 'size' bytes.
+    static inline void* TrackAllocation(void* mem, size_t size) {
+        if (mem == nullptr)
+            return nullptr;
+
+        uint32_t stackId = 0;
+        if (hookState.IsAccounting())
         {
-            memcpy(mem, &magicValue, sizeof(size_t));
-            memcpy(mem + sizeof(size_t), &size, sizeof(size_t));
+            size_t requestedSize = size;
+#ifndef USE_PAYLOAD
+            size = allocator.UsableSize(mem);
+#endif
+            stackId = AccountAllocation(ChargedSize(size));
+
+            if (allocationRecorder.IsActive())
+                RecordEvent(RECORD_ALLOC, mem, requestedSize, allocator.UsableSize(mem), stackId);
         }
-        return mem + PAYLOAD_BYTES;
-#else
-        return mem;
-#endif
-    }
-
-
-    void free(void* mem) {
-        if (mem == nullptr)
-            return;
-
-        void* originalAddr = mem;
-
-#ifdef USE_PAYLOAD
-        uint8_t * addr = (uint8_t*)mem - PAYLOAD_BYTES;
+
+#ifdef USE_PAYLOAD
+        allocationTable.Insert(mem, size, stackId);
+#elif defined(USE_BACKTRACE)
+        if (stackId != 0)
+            allocationTable.Insert(mem, size, stackId);
+#endif
+
+        return mem;
+    }
+
+    // Account a block that is about to be freed.
+    static inline void TrackFree(void* mem) {
+#if defined(USE_PAYLOAD) || defined(USE_BACKTRACE)
         size_t size = 0;
-        if (PAYLOAD_BYTES > 2 * sizeof(size_t))
+        uint32_t stackId = 0;
+        TakeMetadata(mem, size, stackId);
+
+        if (hookState.IsAccounting())
         {
-            size_t magic = 0;
-            memcpy(&magic, addr, sizeof(size_t));
+#ifndef USE_PAYLOAD
+            size = allocator.UsableSize(mem);
+#endif
+            if (size > 0)
+                AccountFree(ChargedSize(size), stackId);
 
-            if (magic == magicValue)
-                memcpy(&size, addr + sizeof(size_t), sizeof(size_t));
+            if (allocationRecorder.IsActive())
+                RecordEvent(RECORD_FREE, mem, size, 0, stackId);
         }
 #else
-        uint8_t* addr = (uint8_t*)mem;
-        size_t size = malloc_usable_size(mem);
+        if (hookState.IsAccounting())
+        {
+            size_t size = allocator.UsableSize(mem);
+            AccountFree(ChargedSize(size), 0);
+
+            if (allocationRecorder.IsActive())
+                RecordEvent(RECORD_FREE, mem, size, 0, 0);
+        }
 #endif
+    }
+
+    void* malloc(size_t size) {
+        if (size == 0) // Treat zero-allocations as non-zero for sake of testing.
+            size = 1;
 
+        return TrackAllocation(allocator.Malloc(size), size);
+    }
+
+
+    void free(void* mem) {
+        if (mem == nullptr)
+            return;
 
-        if (!reentrant && started && !inInstrumentation
-            && (mainThread == 0 || GetThreadId() == mainThread)
-            )
+        TrackFree(mem);
+
+        if (started)
+            allocator.Free(mem);
+    }
+
+    void* calloc(size_t num, size_t size) {
+        if (size != 0 && num > SIZE_MAX / size)
         {
+            errno = ENOMEM;
+            return nullptr;
+        }
 
-            //GUARD_REENTRANT(printf("[free] addr: %p - size: %d - currentEdge.memAllocated: %d - currentEdge.maxMemAllocated: %d\n", addr, (int)size, (int)(currentEdge.memAllocated), (int)(currentEdge.maxMemAllocated)));
+        if (num == 0 || size == 0)
+            num = size = 1;
 
+        return TrackAllocation(allocator.Calloc(num, size), num * size);
+    }
 
-#ifdef USE_BACKTRACE
-            DEBUG_ASSERT_EXIT(currentEdge.allocMap);
-            auto& map = *currentEdge.allocMap;
+    void* realloc(void* ptr, size_t new_size) {
 
-            if (addrToSource.find(addr) != addrToSource.end()) {
-                // GUARD_REENTRANT(printf("addrToSource hit\n"));
-                GUARD_REENTRANT(map[addrToSource[addr]] -= size);
-            }
-            else {
-                //   GUARD_REENTRANT(printf("addrToSource MISS\n"));
-            }
+        if (ptr == nullptr)
+            return malloc(new_size);
+
+#if defined(USE_PAYLOAD) || defined(USE_BACKTRACE)
+        size_t oldSize = 0;
+        uint32_t stackId = 0;
+        bool hadMetadata = TakeMetadata(ptr, oldSize, stackId);
+#else
+        if (!hookState.IsAccounting())
+            return allocator.Realloc(ptr, new_size);
+
+        size_t oldSize = 0;
+        uint32_t stackId = 0;
 #endif
 
-            currentEdge.memAllocated -= size;
+#ifndef USE_PAYLOAD
+        if (hookState.IsAccounting())
+            oldSize = allocator.UsableSize(ptr);
+#endif
+
+        void* mem = allocator.Realloc(ptr, new_size);
 
+        // On failure the old block is left untouched, and so is its accounting.
+        if (mem == nullptr && new_size != 0)
+        {
+#if defined(USE_PAYLOAD) || defined(USE_BACKTRACE)
+            if (hadMetadata)
+                allocationTable.Insert(ptr, oldSize, stackId);
+#endif
+            return nullptr;
         }
 
-        numFrees++;
-
-
-
-        if (size > 0 && started)
-            __libc_free((void*)addr);
-    }
-
-    void* calloc(size_t num, size_t size) {
-        void* mem = malloc(num * size);
-        memset(mem, 0, num * size);
-        return mem;
-    }
-
-    void* realloc(void* ptr, size_t new_size) {
-
-        if (ptr == nullptr)
-            return malloc(new_size);
-
-#ifdef USE_PAYLOAD
-        uint8_t * oldptr = (uint8_t*)ptr - PAYLOAD_BYTES;
-
-        size_t size = 0;
-        int64_t diff = 0;
+#ifdef USE_PAYLOAD
+        size_t newSize = new_size;
+#else
+        size_t newSize = allocator.UsableSize(mem);
+#endif
 
-        if (PAYLOAD_BYTES > 2 * sizeof(size_t))
+        // Account the old block as freed and the new one as allocated, so that the
+        // new block gets its own source. The peak is the same as charging the difference.
+        if (hookState.IsAccounting())
         {
-            size_t magic = 0;
-            memcpy(&magic, oldptr, sizeof(size_t));
+            if (oldSize > 0)
+                AccountFree(ChargedSize(oldSize), stackId);
 
-            if (magic == magicValue)
-                memcpy(&size, oldptr + sizeof(size_t), sizeof(size_t));
+            if (allocationRecorder.IsActive() && oldSize > 0)
+                RecordEvent(RECORD_FREE, ptr, oldSize, 0, stackId);
 
-            if (size > 0)
-                diff = (int64_t)new_size - (int64_t)size;
-
-        }
-
-
-        uint8_t* mem = (uint8_t*)__libc_realloc(oldptr, new_size + PAYLOAD_BYTES);
-#else
-        size_t oldSize = malloc_usable_size(ptr);
-        uint8_t * mem = (uint8_t*)__libc_realloc(ptr, new_size);
-        int64_t diff = (int64_t)malloc_usable_size(mem) - (int64_t)oldSize;
-#endif
-
-        bool isMainThread = mainThread == 0 || (GetThreadId() == mainThread);
+            stackId = AccountAllocation(ChargedSize(newSize));
 
-        bool newMax = false;
+            if (allocationRecorder.IsActive() && mem != nullptr)
+                RecordEvent(RECORD_ALLOC, mem, new_size, allocator.UsableSize(mem), stackId);
+        }
+
+#ifdef USE_PAYLOAD
+        allocationTable.Insert(mem, newSize, stackId);
+#elif defined(USE_BACKTRACE)
+        if (stackId != 0)
+            allocationTable.Insert(mem, newSize, stackId);
+#endif
+
+        return mem;
+    }
+
+    void* memalign(size_t alignment, size_t size) {
+        if (size == 0)
+            size = 1;
+
+        return TrackAllocation(allocator.Memalign(alignment, size), size);
+    }
+
+    void* aligned_alloc(size_t alignment, size_t size) {
+        return memalign(alignment, size);
+    }
 
-        if (!reentrant && started && !inInstrumentation && isMainThread)
+    int posix_memalign(void** memptr, size_t alignment, size_t size) {
+        if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0 || alignment == 0)
+            return EINVAL;
+
+        void* mem = memalign(alignment, size);
+        if (mem == nullptr)
+            return ENOMEM;
+
+        *memptr = mem;
+        return 0;
+    }
+
+    void* valloc(size_t size) {
+        return memalign(sysconf(_SC_PAGESIZE), size);
+    }
+
+    void* pvalloc(size_t size) {
+        size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+        return memalign(pageSize, (size + pageSize - 1) & ~(pageSize - 1));
+    }
+
+    // Anonymous mappings charged to the program (start -> end and stack id), so that
+    // munmap and mremap can uncharge them, possibly in part. Mappings are rare, so a
+    // mutex is enough. The mappings glibc's malloc makes itself don't go through these
+    // hooks: they are already accounted as allocations.
+    struct Mapping {
+        uintptr_t end;
+        uint32_t stackId;
+    };
+
+    static ToolMap<uintptr_t, Mapping> mappings;
+    static std::atomic<size_t> numMappings{ 0 };
+    static std::mutex mappingsMutex;
+
+    static inline size_t RoundToPages(size_t length) {
+        size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+        return (length + pageSize - 1) & ~(pageSize - 1);
+    }
+
+    static void TrackMapping(void* mem, size_t length) {
+        length = RoundToPages(length);
+        uint32_t stackId = AccountAllocation(length);
+
+        if (allocationRecorder.IsActive())
+            RecordEvent(RECORD_MAP, mem, length, 0, stackId);
+
+        hookState.EnterReentrant();
         {
-            if (diff > 0)
-                currentEdge.memAllocated += diff;
-            else currentEdge.memAllocated -= diff;
+            std::lock_guard<std::mutex> lock(mappingsMutex);
+            mappings[(uintptr_t)mem] = { (uintptr_t)mem + length, stackId };
+            numMappings.store(mappings.size(), std::memory_order_relaxed);
+        }
+        hookState.ExitReentrant();
+    }
 
-            if (currentEdge.memAllocated > currentEdge.maxMemAllocated) {
-#ifdef USE_BACKTRACE
-                if (currentEdge.memAllocated > 2 * currentEdge.maxAllocMapSize)
-                    newMax = true;
-#endif
+    // Forget the charged mappings in [start, end), uncharging them if the thread is
+    // accounting. Returns the number of bytes that were charged.
+    static size_t UntrackRange(uintptr_t start, uintptr_t end) {
+        if (numMappings.load(std::memory_order_relaxed) == 0)
+            return 0;
 
-                currentEdge.maxMemAllocated = currentEdge.memAllocated;
-            }
+        bool accounting = hookState.IsAccounting();
+        size_t untracked = 0;
 
-#ifdef USE_BACKTRACE
-            if (!reentrant && new_size > minSizeBacktrace)
+        hookState.EnterReentrant();
+        {
+            std::lock_guard<std::mutex> lock(mappingsMutex);
+
+            auto it = mappings.upper_bound(start);
+            if (it != mappings.begin() && std::prev(it)->second.end > start)
+                --it;
+
+            while (it != mappings.end() && it->first < end)
             {
-                //   if (new_size > currentEdge.biggestAllocation)
-                {
-                    bt(currentEdge, size, newMax, mem);
-                    currentEdge.biggestAllocation = size;
-                }
+                uintptr_t mapStart = it->first;
+                Mapping mapping = it->second;
+                it = mappings.erase(it);
+
+                size_t overlap = std::min(end, mapping.end) - std::max(start, mapStart);
+                untracked += overlap;
+                if (accounting)
+                    AccountFree(overlap, mapping.stackId);
+                if (accounting && allocationRecorder.IsActive())
+                    RecordEvent(RECORD_UNMAP, (void*)std::max(start, mapStart), overlap, 0, mapping.stackId);
+
+                if (mapStart < start)
+                    mappings[mapStart] = { start, mapping.stackId };
+                if (mapping.end > end)
+                    it = mappings.emplace(end, Mapping{ mapping.end, mapping.stackId }).first;
+            }
 
-            }
-#endif
-        }
-
-
-
-
-
-        // Store the size of the allocation.
-#ifdef USE_PAYLOAD
-        if (PAYLOAD_BYTES > 2 * sizeof(size_t))
+            numMappings.store(mappings.size(), std::memory_order_relaxed);
+        }
+        hookState.ExitReentrant();
+
+        return untracked;
+    }
+
+    // Only mappings that hold program data are charged: anonymous and accessible. Stacks
+    // (the runtime's fibers, the threads' stacks) aren't allocations of the program.
+    static inline bool IsChargedMapping(int prot, int flags) {
+        return (flags & MAP_ANONYMOUS) != 0 && (flags & (MAP_STACK | MAP_GROWSDOWN)) == 0 && prot != PROT_NONE;
+    }
+
+    void* mmap(void* addr, size_t length, int prot, int flags, int fd, off_t offset) {
+        void* mem = (void*)syscall(SYS_mmap, addr, length, prot, flags, fd, offset);
+
+        // A fixed mapping replaces those it overlaps, if it succeeds.
+        if (mem != MAP_FAILED && (flags & MAP_FIXED) != 0)
         {
-            memcpy(mem, &magicValue, sizeof(size_t));
-            memcpy(mem + sizeof(size_t), &new_size, sizeof(size_t));
+            numUnmaps.fetch_add(1, std::memory_order_relaxed);
+            UntrackRange((uintptr_t)mem, (uintptr_t)mem + RoundToPages(length));
         }
-
-
-        return mem + PAYLOAD_BYTES;
-#else
-        return mem;
-#endif
-    }
-
-    void* memalign(size_t alignment, size_t size /*, const void *caller */) {
-        DEBUG_ASSERT(alignment <= PAYLOAD_BYTES);
-#ifdef USE_PAYLOAD
-        return malloc(size);
-#else 
-        return malloc(PAYLOAD_BYTES + size);
-#endif
-        //  return __libc_memalign(alignment, size, caller);
-
-       //  return mem + sizeof(size_t);
-    }
-
-}
\ No newline at end of file
+
+        if (mem != MAP_FAILED && hookState.IsAccounting() && IsChargedMapping(prot, flags))
+            TrackMapping(mem, length);
+
+        return mem;
+    }
+
+    void* mmap64(void* addr, size_t length, int prot, int flags, int fd, off64_t offset) {
+        return mmap(addr, length, prot, flags, fd, offset);
+    }
+
+    int munmap(void* addr, size_t length) {
+        int result = (int)syscall(SYS_munmap, addr, length);
+
+        if (result == 0)
+        {
+            numUnmaps.fetch_add(1, std::memory_order_relaxed);
+            UntrackRange((uintptr_t)addr, (uintptr_t)addr + RoundToPages(length));
+        }
+
+        return result;
+    }
+
+    void* mremap(void* oldAddress, size_t oldSize, size_t newSize, int flags, ...) {
+        void* newAddress = nullptr;
+        if ((flags & MREMAP_FIXED) != 0)
+        {
+            va_list args;
+            va_start(args, flags);
+            newAddress = va_arg(args, void*);
+            va_end(args);
+        }
+
+        void* mem = (void*)syscall(SYS_mremap, oldAddress, oldSize, newSize, flags, newAddress);
+        if (mem == MAP_FAILED)
+            return mem;
+        numUnmaps.fetch_add(1, std::memory_order_relaxed);
+
+        // Like realloc: the old mapping is uncharged and the new one charged, if the old one was.
+        if (UntrackRange((uintptr_t)oldAddress, (uintptr_t)oldAddress + RoundToPages(oldSize)) > 0 && hookState.IsAccounting())
+            TrackMapping(mem, newSize);
+
+        return mem;
+    }
+
+    // Name of the allocator that serves the program's blocks (see AllocatorBackend).
+    const char* GetAllocatorName() {
+        return allocator.GetName();
+    }
+
+    // Number of live allocations with shadow metadata and bytes reserved for it.
+    void GetAllocationTableStats(size_t* liveEntries, size_t* reservedBytes) {
+#if defined(USE_PAYLOAD) || defined(USE_BACKTRACE)
+        allocationTable.GetStats(*liveEntries, *reservedBytes);
+#else
+        *liveEntries = 0;
+        *reservedBytes = 0;
+#endif
+    }
+
+}
+
+// The C++ allocation functions go straight to the hooks instead of through
+// libstdc++'s operator new and the PLT. Sized deallocation uncharges the same
+// usable size as free: the size the compiler passes is the request, not what the
+// block was charged.
+
+static inline void* NewOrThrow(size_t size) {
+    while (true)
+    {
+        void* mem = malloc(size);
+        if (mem != nullptr)
+            return mem;
+
+        std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr)
+            throw std::bad_alloc();
+        handler();
+    }
+}
+
+void* operator new(size_t size) { return NewOrThrow(size); }
+void* operator new[](size_t size) { return NewOrThrow(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return malloc(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return malloc(size); }
+
+void operator delete(void* mem) noexcept { free(mem); }
+void operator delete[](void* mem) noexcept { free(mem); }
+void operator delete(void* mem, const std::nothrow_t&) noexcept { free(mem); }
+void operator delete[](void* mem, const std::nothrow_t&) noexcept { free(mem); }
+// The size is ignored: the usable size of a block can't be derived from its request (glibc
+// doesn't split off remainders smaller than a chunk, and MHWM_Allocator picks the size classes),
+// and charging the request instead would leave blocks released by free or an unsized delete
+// uncharged by a different amount.
+void operator delete(void* mem, size_t) noexcept { free(mem); }
+void operator delete[](void* mem, size_t) noexcept { free(mem); }
+
+#ifdef __cpp_aligned_new
+static inline void* AlignedNewOrThrow(size_t size, std::align_val_t alignment) {
+    while (true)
+    {
+        void* mem = memalign((size_t)alignment, size);
+        if (mem != nullptr)
+            return mem;
+
+        std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr)
+            throw std::bad_alloc();
+        handler();
+    }
+}
+
+void* operator new(size_t size, std::align_val_t alignment) { return AlignedNewOrThrow(size, alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return AlignedNewOrThrow(size, alignment); }
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return memalign((size_t)alignment, size); }
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return memalign((size_t)alignment, size); }
+
+// Aligned blocks may have slack in front of them, so their size isn't computed.
+void operator delete(void* mem, std::align_val_t) noexcept { free(mem); }
+void operator delete[](void* mem, std::align_val_t) noexcept { free(mem); }
+void operator delete(void* mem, std::align_val_t, const std::nothrow_t&) noexcept { free(mem); }
+void operator delete[](void* mem, std::align_val_t, const std::nothrow_t&) noexcept { free(mem); }
+void operator delete(void* mem, size_t, std::align_val_t) noexcept { free(mem); }
+void operator delete[](void* mem, size_t, std::align_val_t) noexcept { free(mem); }
+#endif
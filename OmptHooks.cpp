@@ -0,0 +1,312 @@
+#include <omp-tools.h>
+#include <atomic>
+#include "hooks.h"
+#include "CSIMetadata.h"
+
+#ifndef NO_FUNC_HOOKS
+#error "The OpenMP front-end has no function hooks: build it with NO_FUNC_HOOKS"
+#endif
+
+// OpenMP front-end (USE_OMPT): this file replaces hooks.cpp in OpenMP programs, built with a stock
+// compiler and libomp, which load the tool through ompt_start_tool. The OMPT events of the tasks
+// are mapped to the spawns and syncs of the Cilk front-end, in the same strand logs, so that the
+// same SP DAG engines compute the bounds:
+// - creating a task spawns it from the encountering task, whose strand goes on as the continuation;
+//   undeferred tasks are spawned too, since libomp also reports as undeferred the tasks it runs at
+//   once in serialized teams or when its queues are full, which other schedules defer;
+// - taskwait, and the end of a taskgroup, sync the children of the task;
+// - a task that completes with children that weren't waited for syncs them at its end, like the
+//   implicit sync of a Cilk function;
+// - a parallel region spawns its implicit tasks from the encountering task, and syncs them at its
+//   end.
+// Barriers within a parallel region and task dependences aren't series-parallel and are ignored.
+// All events are at level 0: the frames of the tasks are told apart by their region ids, the
+// addresses of their tool data.
+
+// hooks.cpp isn't linked into OpenMP programs.
+thread_local size_t currentLevel = 0;
+CSIMetadata csiMetadata;
+
+// Set while the OpenMP runtime has the tool initialized, like from the entry of main to its exit
+// with the CSI front-end.
+bool started = false;
+
+extern std::atomic<bool> windowOpen;
+extern bool exitHandlerRegistered;
+void RegisterExitHandler();
+void ChargeResidency(SPStrandLog* log);
+void SetStrandLog(SPStrandLog* log);
+extern "C" void TryReplayStrandLogs();
+
+// Tool data of a task (task_data->ptr).
+struct OmptTask : public ToolAllocated {
+    // Current log of the task: the thread that runs it records into it. Null once it ended.
+    SPStrandLog* log = nullptr;
+    // Whether the task spawned children since its last sync.
+    bool spawned = false;
+    // Implicit tasks are ended by their thread or by the end of their parallel region, whichever
+    // comes first, and deleted by the second.
+    std::atomic<bool> ended{ false };
+    std::atomic<int> references{ 1 };
+};
+
+// Tool data of a parallel region (parallel_data->ptr): its implicit tasks, by index in the team.
+struct OmptParallel : public ToolAllocated {
+    ToolVector<OmptTask*> implicitTasks;
+};
+
+static OmptTask* GetTask(ompt_data_t* taskData) {
+    if (taskData->ptr == nullptr)
+        taskData->ptr = new OmptTask();
+    return (OmptTask*)taskData->ptr;
+}
+
+static void ReleaseTask(OmptTask* task) {
+    if (task->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        delete task;
+}
+
+// End the strand of the calling thread with a spawn in 'regionId' and return the log of the
+// spawned task. Unlike cilk_spawn, the thread goes on with the continuation.
+static SPStrandLog* SpawnStrand(size_t regionId) {
+    SPStrandLog* log = hookState.log;
+    ChargeResidency(log);
+
+    log->Append(true, regionId, currentLevel, nullptr, 0);
+
+    SPStrandLog* task = new SPStrandLog();
+    SPStrandLog* continuation = new SPStrandLog();
+    continuation->exitNext = log->exitNext;
+    task->exitNext = continuation;
+
+    log->Close(task);
+    SetStrandLog(continuation);
+    return task;
+}
+
+// Sync the children the calling thread's strand spawned in 'regionId'.
+static void SyncStrand(size_t regionId) {
+    SPStrandLog* log = hookState.log;
+    ChargeResidency(log);
+
+    log->Append(false, regionId, currentLevel, nullptr, 0);
+
+    // Merge the logs of the strands that are now complete.
+    TryReplayStrandLogs();
+}
+
+// End the last strand of 'task', which syncs the children it didn't wait for.
+static void EndTask(OmptTask* task) {
+    SPStrandLog* log = task->log;
+    ChargeResidency(log);
+
+    if (task->spawned)
+        log->Append(false, (uintptr_t)task, currentLevel, nullptr, 0);
+    log->Append(false, 0, currentLevel, nullptr, 0);
+
+    log->Close(log->exitNext);
+    task->log = nullptr;
+}
+
+// The task the calling thread runs completes.
+static void ExitTask(OmptTask* task) {
+    EndTask(task);
+
+    // Whatever this thread does next belongs to another strand.
+    SetStrandLog(nullptr);
+}
+
+static void OnParallelBegin(ompt_data_t* encounteringTaskData, const ompt_frame_t* encounteringTaskFrame,
+    ompt_data_t* parallelData, unsigned int requestedParallelism, int flags, const void* codeptr) {
+    // Regions encountered by untracked tasks stay untracked.
+    if (hookState.log == nullptr || !windowOpen.load(std::memory_order_relaxed))
+        return;
+
+    hookState.EnterInstrumentation();
+
+    if (!exitHandlerRegistered)
+        RegisterExitHandler();
+
+    OmptParallel* parallel = new OmptParallel();
+    for (unsigned int i = 0; i < requestedParallelism; ++i)
+    {
+        OmptTask* task = new OmptTask();
+        task->log = SpawnStrand((uintptr_t)parallel);
+        // Held by the region and by the thread that runs the task.
+        task->references.store(2, std::memory_order_relaxed);
+        parallel->implicitTasks.push_back(task);
+    }
+    parallelData->ptr = parallel;
+
+    // The encountering thread runs one of the implicit tasks: the encountering task waits
+    // for the end of the region.
+    GetTask(encounteringTaskData)->log = hookState.log;
+    SetStrandLog(nullptr);
+
+    hookState.ExitInstrumentation();
+}
+
+static void OnParallelEnd(ompt_data_t* parallelData, ompt_data_t* encounteringTaskData, int flags,
+    const void* codeptr) {
+    OmptParallel* parallel = (OmptParallel*)parallelData->ptr;
+    if (parallel == nullptr)
+        return;
+
+    hookState.EnterInstrumentation();
+
+    // libomp reports the end of the implicit task of a worker once the worker starts its next
+    // region. Every thread of the team passed the barrier at the end of the region: end their
+    // tasks here, like those of the threads the team may lack.
+    for (OmptTask* task : parallel->implicitTasks)
+    {
+        if (!task->ended.exchange(true, std::memory_order_acq_rel))
+            EndTask(task);
+        ReleaseTask(task);
+    }
+
+    SetStrandLog(GetTask(encounteringTaskData)->log);
+    SyncStrand((uintptr_t)parallel);
+
+    delete parallel;
+    parallelData->ptr = nullptr;
+
+    hookState.ExitInstrumentation();
+}
+
+static void OnImplicitTask(ompt_scope_endpoint_t endpoint, ompt_data_t* parallelData, ompt_data_t* taskData,
+    unsigned int actualParallelism, unsigned int index, int flags) {
+    // The initial task runs main with the log tracking started with. It ends after tracking.
+    if (flags & ompt_task_initial)
+        return;
+
+    hookState.EnterInstrumentation();
+
+    if (endpoint == ompt_scope_begin)
+    {
+        OmptParallel* parallel = parallelData != nullptr ? (OmptParallel*)parallelData->ptr : nullptr;
+        if (parallel != nullptr && index < parallel->implicitTasks.size())
+        {
+            OmptTask* task = parallel->implicitTasks[index];
+            taskData->ptr = task;
+            SetStrandLog(task->log);
+        }
+    }
+    else
+    {
+        OmptTask* task = (OmptTask*)taskData->ptr;
+        if (task != nullptr)
+        {
+            if (!task->ended.exchange(true, std::memory_order_acq_rel))
+                ExitTask(task);
+            else
+                SetStrandLog(nullptr);
+
+            ReleaseTask(task);
+            taskData->ptr = nullptr;
+        }
+    }
+
+    hookState.ExitInstrumentation();
+}
+
+static void OnTaskCreate(ompt_data_t* encounteringTaskData, const ompt_frame_t* encounteringTaskFrame,
+    ompt_data_t* newTaskData, int flags, int hasDependences, const void* codeptr) {
+    if (!(flags & ompt_task_explicit) || hookState.log == nullptr || !windowOpen.load(std::memory_order_relaxed))
+        return;
+
+    hookState.EnterInstrumentation();
+
+    if (!exitHandlerRegistered)
+        RegisterExitHandler();
+
+    OmptTask* parent = GetTask(encounteringTaskData);
+    OmptTask* task = new OmptTask();
+    task->log = SpawnStrand((uintptr_t)parent);
+    parent->log = hookState.log;
+    parent->spawned = true;
+    newTaskData->ptr = task;
+
+    hookState.ExitInstrumentation();
+}
+
+static void OnTaskSchedule(ompt_data_t* priorTaskData, ompt_task_status_t priorTaskStatus,
+    ompt_data_t* nextTaskData) {
+    // A detached task completes when its event is fulfilled, after its body returned.
+    if (priorTaskStatus == ompt_task_early_fulfill || priorTaskStatus == ompt_task_late_fulfill)
+        return;
+
+    hookState.EnterInstrumentation();
+
+    OmptTask* prior = priorTaskData != nullptr ? (OmptTask*)priorTaskData->ptr : nullptr;
+    if (prior != nullptr && prior->log != nullptr && (priorTaskStatus == ompt_task_complete ||
+        priorTaskStatus == ompt_task_cancel || priorTaskStatus == ompt_task_detach))
+    {
+        ExitTask(prior);
+        ReleaseTask(prior);
+        priorTaskData->ptr = nullptr;
+    }
+
+    // The prior task, if suspended, keeps its log until a thread resumes it.
+    OmptTask* next = nextTaskData != nullptr ? (OmptTask*)nextTaskData->ptr : nullptr;
+    SetStrandLog(next != nullptr ? next->log : nullptr);
+
+    hookState.ExitInstrumentation();
+}
+
+static void OnSyncRegion(ompt_sync_region_t kind, ompt_scope_endpoint_t endpoint, ompt_data_t* parallelData,
+    ompt_data_t* taskData, const void* codeptr) {
+    // While the task waits, the thread may run other tasks: the schedule events switch the logs.
+    if ((kind != ompt_sync_region_taskwait && kind != ompt_sync_region_taskgroup) || endpoint != ompt_scope_end)
+        return;
+
+    OmptTask* task = taskData != nullptr ? (OmptTask*)taskData->ptr : nullptr;
+    if (task == nullptr || !task->spawned || hookState.log == nullptr)
+        return;
+
+    hookState.EnterInstrumentation();
+
+    SyncStrand((uintptr_t)task);
+    task->spawned = false;
+
+    hookState.ExitInstrumentation();
+}
+
+static int InitializeTool(ompt_function_lookup_t lookup, int initialDeviceNum, ompt_data_t* toolData) {
+    ompt_set_callback_t setCallback = (ompt_set_callback_t)lookup("ompt_set_callback");
+
+    struct {
+        ompt_callbacks_t event;
+        ompt_callback_t callback;
+    } callbacks[] = {
+        { ompt_callback_parallel_begin, (ompt_callback_t)OnParallelBegin },
+        { ompt_callback_parallel_end, (ompt_callback_t)OnParallelEnd },
+        { ompt_callback_implicit_task, (ompt_callback_t)OnImplicitTask },
+        { ompt_callback_task_create, (ompt_callback_t)OnTaskCreate },
+        { ompt_callback_task_schedule, (ompt_callback_t)OnTaskSchedule },
+        { ompt_callback_sync_region, (ompt_callback_t)OnSyncRegion },
+    };
+
+    for (const auto& entry : callbacks)
+    {
+        if (setCallback(entry.event, entry.callback) != ompt_set_always)
+        {
+            std::cerr << "ERROR: The OpenMP runtime doesn't report every task event (callback " << entry.event << ")\n";
+            return 0;
+        }
+    }
+
+    started = true;
+    return 1;
+}
+
+static void FinalizeTool(ompt_data_t* toolData) {
+    started = false;
+}
+
+extern "C" {
+
+    ompt_start_tool_result_t* ompt_start_tool(unsigned int ompVersion, const char* runtimeVersion) {
+        static ompt_start_tool_result_t result = { InitializeTool, FinalizeTool, { 0 } };
+        return &result;
+    }
+}
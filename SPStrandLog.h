@@ -0,0 +1,238 @@
+#pragma once
+#include "SeriesParallelDAG.h"
+#include "AllocationRecorder.h"
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+#if defined(USE_FUNC_PROFILE) && defined(NO_FUNC_HOOKS)
+#error "USE_FUNC_PROFILE needs the function entries and exits to be instrumented"
+#endif
+
+// A Spawn or Sync event recorded by a Cilk worker. Events are replayed
+// into the SP DAG in the serial order of the program.
+struct SPStrandEvent {
+    bool spawn = false;
+    size_t regionId = 0;
+    size_t level = 0;
+    char* locationName = nullptr;
+    int32_t locationLine = 0;
+    // Id of the edge that ends at this event in the allocation recording (0 if not recording).
+    uint32_t edgeId = 0;
+    SPEdgeData data;
+};
+
+#ifdef USE_FUNC_PROFILE
+enum SPProfileKind : uint8_t {
+    PROFILE_ENTRY,
+    PROFILE_EXIT,
+    PROFILE_SPAWN, // End of the strand at a spawn.
+    PROFILE_SYNC,  // End of the strand at a sync (region 0 for a task exit).
+};
+
+// A point of a strand where the function profile (USE_FUNC_PROFILE) samples the memory of
+// the strand: a function entry or exit, or the end of the strand. Replayed in serial order,
+// the records split the strands into segments between the calls (see FunctionProfile.h).
+struct SPProfileRecord {
+    SPProfileKind kind;
+    // Function id for entries and exits, region id otherwise.
+    uint64_t id;
+    int64_t memAllocated;
+    // Peak of the strand since the previous record.
+    int64_t maxMemAllocated;
+    int64_t bytesAllocated;
+};
+#endif
+
+// The events of a serial piece of the program that was executed by a single worker.
+// Logs are chained through 'next' in serial (depth-first) order: a log that ends with
+// a spawn is followed by the log of the spawned task, whose task exit is followed
+// by the log of the continuation.
+struct SPStrandLog : public ToolAllocated {
+    // Allocations performed by the strand that is currently executing in this log.
+    SPEdgeData currentEdge;
+    uint32_t currentEdgeId = allocationRecorder.NewEdgeId();
+
+    ToolVector<SPStrandEvent> events;
+
+    // Function level to restore when a worker resumes this log.
+    size_t level = 0;
+
+    // Log that follows the task exit of the spawned task this log belongs to.
+    SPStrandLog* exitNext = nullptr;
+
+    SPStrandLog* next = nullptr;
+    std::atomic<bool> closed{ false };
+
+#ifdef USE_FUNC_PROFILE
+    ToolVector<SPProfileRecord> profile;
+    // Peak of the current strand before the last record: each record restarts the peak of
+    // the edge, so that the next one gets the peak of its segment alone.
+    int64_t strandMax = 0;
+
+    __attribute__((noinline)) void AppendProfile(SPProfileKind kind, uint64_t id) {
+        profile.push_back({ kind, id, currentEdge.memAllocated, currentEdge.maxMemAllocated, currentEdge.bytesAllocated });
+
+        if (currentEdge.maxMemAllocated > strandMax)
+            strandMax = currentEdge.maxMemAllocated;
+        currentEdge.maxMemAllocated = currentEdge.memAllocated;
+    }
+#endif
+
+    void Append(bool spawn, size_t regionId, size_t level, char* locationName, int32_t locationLine) {
+        events.emplace_back();
+
+        SPStrandEvent& event = events.back();
+        event.spawn = spawn;
+        event.regionId = regionId;
+        event.level = level;
+        event.locationName = locationName;
+        event.locationLine = locationLine;
+        event.edgeId = currentEdgeId;
+
+#ifdef USE_FUNC_PROFILE
+        // The DAG gets the peak of the whole strand.
+        AppendProfile(spawn ? PROFILE_SPAWN : PROFILE_SYNC, regionId);
+        currentEdge.maxMemAllocated = strandMax;
+        strandMax = 0;
+#endif
+
+        event.data = currentEdge;
+
+        currentEdge = SPEdgeData();
+        currentEdgeId = allocationRecorder.NewEdgeId();
+    }
+
+    // No more events will be appended to this log. 'next' must be set before
+    // the log is published as closed, since the replay follows it right away.
+    void Close(SPStrandLog* nextLog) {
+        next = nextLog;
+        closed.store(true, std::memory_order_release);
+    }
+
+    bool IsClosed() { return closed.load(std::memory_order_acquire); }
+};
+
+// Associates a Cilk frame with the log a worker must continue with when it resumes that
+// frame, either after a steal (continuation) or after a sync that completed on another worker.
+class SPStrandLogMap {
+public:
+    void Put(uintptr_t frame, SPStrandLog* log) {
+        Shard& shard = GetShard(frame);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.logs[frame] = log;
+    }
+
+    SPStrandLog* Take(uintptr_t frame) {
+        Shard& shard = GetShard(frame);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        auto it = shard.logs.find(frame);
+        if (it == shard.logs.end())
+            return nullptr;
+
+        SPStrandLog* log = it->second;
+        shard.logs.erase(it);
+        return log;
+    }
+
+private:
+    static constexpr size_t NUM_SHARDS = 64;
+
+    struct Shard {
+        std::mutex mutex;
+        ToolUnorderedMap<uintptr_t, SPStrandLog*> logs;
+    };
+
+    // Keys of distinct live frames are stack addresses far apart, so skip the low bits.
+    Shard& GetShard(uintptr_t frame) { return shards[(frame >> 4) % NUM_SHARDS]; }
+
+    Shard shards[NUM_SHARDS];
+};
+
+// Continuations of the spawns of a worker that haven't been resumed yet, innermost last. The
+// worker pushes and pops its own entries without locks. A continuation is resumed by another
+// worker if it was stolen: that thief claims its entry, which the owner discards later.
+class ContinuationStack : public ToolAllocated {
+public:
+    // Spawns nested deeper than this aren't kept on the stack.
+    static constexpr size_t CAPACITY = 4096;
+
+    // Other stacks, of the workers that registered before this one.
+    ContinuationStack* nextStack = nullptr;
+
+    // Called by the owner. Returns false if the stack is full.
+    bool Push(uintptr_t frame, SPStrandLog* log) {
+        size_t top = this->top.load(std::memory_order_relaxed);
+        if (top == CAPACITY)
+            return false;
+
+        Entry& entry = entries[top];
+        entry.log.store(log, std::memory_order_relaxed);
+        entry.frame.store(frame, std::memory_order_release);
+        this->top.store(top + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Called by the owner when it resumes the continuation of 'frame'. Returns nullptr if it isn't
+    // the innermost one: the owner didn't spawn from 'frame', or the spawn didn't fit on the stack.
+    SPStrandLog* Pop(uintptr_t frame) {
+        // The children that ran since the spawn left only stolen entries above it.
+        size_t top = SkipClaimed(this->top.load(std::memory_order_relaxed));
+
+        SPStrandLog* log = nullptr;
+        if (top > 0 && entries[top - 1].frame.load(std::memory_order_relaxed) == frame)
+        {
+            --top;
+            log = entries[top].log.load(std::memory_order_relaxed);
+            entries[top].frame.store(0, std::memory_order_relaxed);
+
+            // Outer spawns may have been stolen in the meantime.
+            top = SkipClaimed(top);
+        }
+
+        this->top.store(top, std::memory_order_release);
+        return log;
+    }
+
+    // Called by a thief when it resumes the stolen continuation of 'frame'. Returns nullptr if
+    // the owner of this stack didn't spawn from 'frame'.
+    SPStrandLog* Claim(uintptr_t frame) {
+        size_t top = this->top.load(std::memory_order_acquire);
+
+        // Thieves steal the outermost continuations.
+        for (size_t i = 0; i < top; ++i)
+        {
+            Entry& entry = entries[i];
+            if (entry.frame.load(std::memory_order_acquire) != frame)
+                continue;
+
+            // Only the thief of a continuation resumes it: the entry stays until it is claimed.
+            SPStrandLog* log = entry.log.load(std::memory_order_relaxed);
+            uintptr_t expected = frame;
+            if (entry.frame.compare_exchange_strong(expected, CLAIMED, std::memory_order_relaxed))
+                return log;
+        }
+
+        return nullptr;
+    }
+
+private:
+    // Frame of an entry that was claimed (frames are aligned).
+    static constexpr uintptr_t CLAIMED = 1;
+
+    struct Entry {
+        std::atomic<uintptr_t> frame{ 0 };
+        std::atomic<SPStrandLog*> log{ nullptr };
+    };
+
+    std::atomic<size_t> top{ 0 };
+    Entry entries[CAPACITY];
+
+    // Top of the stack without the claimed entries at its top.
+    size_t SkipClaimed(size_t top) {
+        while (top > 0 && entries[top - 1].frame.load(std::memory_order_relaxed) == CLAIMED)
+            --top;
+        return top;
+    }
+};
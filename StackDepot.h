@@ -0,0 +1,50 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ToolArena.h"
+
+// Call stacks of the attributed allocations, hash-consed into a trie: a node is a frame
+// (the id of a source location) together with the node of its caller, so every distinct
+// stack gets a single 32-bit id and stacks share the nodes of their common callers.
+// Id 0 is the empty stack. Not thread-safe: callers provide the locking.
+class StackDepot {
+public:
+    StackDepot() : nodes(1) {}
+
+    // Id of the stack in which 'frame' was called from the stack 'caller'.
+    uint32_t Push(uint32_t caller, uint32_t frame) {
+        uint64_t key = ((uint64_t)caller << 32) | frame;
+
+        auto it = index.find(key);
+        if (it != index.end())
+            return it->second;
+
+        uint32_t id = (uint32_t)nodes.size();
+        nodes.push_back({ caller, frame });
+        index.emplace(key, id);
+        return id;
+    }
+
+    uint32_t GetCaller(uint32_t stackId) const { return nodes[stackId].caller; }
+    uint32_t GetFrame(uint32_t stackId) const { return nodes[stackId].frame; }
+
+    // Number of stack ids handed out, including the empty stack.
+    uint32_t GetNumStacks() const { return (uint32_t)nodes.size(); }
+
+private:
+    struct Node {
+        uint32_t caller;
+        uint32_t frame;
+    };
+
+    ToolVector<Node> nodes;
+    ToolUnorderedMap<uint64_t, uint32_t> index;
+};
+
+// Source locations of a stack of the depot of memoryhook.so, innermost first.
+std::string GetStackName(uint32_t stackId);
+
+// Number of stack ids of the depot of memoryhook.so.
+uint32_t GetNumStacks();
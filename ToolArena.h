@@ -0,0 +1,224 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <map>
+#include <new>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Private arena for the tool's own data structures (the SP DAG, the strand logs, the
+// pools and the containers of the tool). Its memory is mapped with the raw system call,
+// so the tool's bookkeeping never goes through the allocation hooks and never shares
+// heap pages with the measured program.
+//
+// Blocks are served from size classes (multiples of 16 bytes up to 1 KiB, then powers
+// of two up to 1 MiB) carved out of 4 MiB regions, and freed blocks are kept on a free
+// list per class. Larger blocks are mapped individually. Frees must pass the size of
+// the block, as STL allocators and sized operator delete do.
+class ToolArena {
+public:
+    void* Allocate(size_t size) {
+        if (size == 0)
+            size = 1;
+
+        if (size > MAX_CLASS_SIZE)
+            return MapPages(size);
+
+        size_t index = ClassIndex(size);
+        SizeClass& sizeClass = classes[index];
+
+        Lock(sizeClass.lock);
+        FreeBlock* block = sizeClass.freeList;
+        if (block != nullptr)
+            sizeClass.freeList = block->next;
+        Unlock(sizeClass.lock);
+
+        if (block != nullptr)
+            return block;
+
+        return Carve(ClassSize(index));
+    }
+
+    void Free(void* mem, size_t size) {
+        if (mem == nullptr)
+            return;
+
+        if (size == 0)
+            size = 1;
+
+        if (size > MAX_CLASS_SIZE)
+        {
+            syscall(SYS_munmap, mem, RoundToPages(size));
+            return;
+        }
+
+        SizeClass& sizeClass = classes[ClassIndex(size)];
+        FreeBlock* block = (FreeBlock*)mem;
+
+        Lock(sizeClass.lock);
+        block->next = sizeClass.freeList;
+        sizeClass.freeList = block;
+        Unlock(sizeClass.lock);
+    }
+
+    // Bytes mapped by the arena (regions and large blocks).
+    size_t GetMappedBytes() { return mappedBytes.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr size_t SMALL_CLASS_STEP = 16;
+    static constexpr size_t MAX_SMALL_SIZE = 1024;
+    static constexpr size_t NUM_SMALL_CLASSES = MAX_SMALL_SIZE / SMALL_CLASS_STEP;
+    static constexpr size_t MAX_CLASS_SIZE = 1 << 20;
+    static constexpr size_t NUM_CLASSES = NUM_SMALL_CLASSES + 10; // 2 KiB ... 1 MiB.
+    static constexpr size_t REGION_SIZE = 4 << 20;
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    struct SizeClass {
+        std::atomic_flag lock = ATOMIC_FLAG_INIT;
+        FreeBlock* freeList = nullptr;
+    };
+
+    static void Lock(std::atomic_flag& lock) {
+        while (lock.test_and_set(std::memory_order_acquire))
+            ;
+    }
+
+    static void Unlock(std::atomic_flag& lock) { lock.clear(std::memory_order_release); }
+
+    static size_t ClassIndex(size_t size) {
+        if (size <= MAX_SMALL_SIZE)
+            return (size - 1) / SMALL_CLASS_STEP;
+
+        // 1025 ... 2048 -> first large class.
+        return NUM_SMALL_CLASSES + (63 - __builtin_clzll(size - 1)) - 10;
+    }
+
+    static size_t ClassSize(size_t index) {
+        if (index < NUM_SMALL_CLASSES)
+            return (index + 1) * SMALL_CLASS_STEP;
+        return (size_t)1 << (index - NUM_SMALL_CLASSES + 11);
+    }
+
+    static size_t RoundToPages(size_t size) {
+        size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+        return (size + pageSize - 1) & ~(pageSize - 1);
+    }
+
+    void* MapPages(size_t size) {
+        size = RoundToPages(size);
+        void* mem = (void*)syscall(SYS_mmap, nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED)
+            throw std::bad_alloc();
+
+        mappedBytes.fetch_add(size, std::memory_order_relaxed);
+        return mem;
+    }
+
+    // Cut a new block of 'size' bytes from the current region.
+    void* Carve(size_t size) {
+        Lock(regionLock);
+
+        if (regionEnd - regionNext < size)
+        {
+            // The rest of the old region is left unused.
+            regionNext = (uintptr_t)MapPages(REGION_SIZE);
+            regionEnd = regionNext + REGION_SIZE;
+        }
+
+        void* mem = (void*)regionNext;
+        regionNext += size;
+
+        Unlock(regionLock);
+        return mem;
+    }
+
+    SizeClass classes[NUM_CLASSES];
+
+    std::atomic_flag regionLock = ATOMIC_FLAG_INIT;
+    uintptr_t regionNext = 0;
+    uintptr_t regionEnd = 0;
+
+    std::atomic<size_t> mappedBytes{ 0 };
+};
+
+// Defined in memoryhook.so, constant-initialized.
+extern ToolArena toolArena;
+
+// STL allocator for the tool's containers.
+template <typename T>
+struct ToolAllocator {
+    using value_type = T;
+
+    ToolAllocator() = default;
+    template <typename U>
+    ToolAllocator(const ToolAllocator<U>&) {}
+
+    T* allocate(size_t n) { return (T*)toolArena.Allocate(n * sizeof(T)); }
+    void deallocate(T* mem, size_t n) { toolArena.Free(mem, n * sizeof(T)); }
+};
+
+template <typename T, typename U>
+bool operator==(const ToolAllocator<T>&, const ToolAllocator<U>&) { return true; }
+template <typename T, typename U>
+bool operator!=(const ToolAllocator<T>&, const ToolAllocator<U>&) { return false; }
+
+template <typename T>
+using ToolVector = std::vector<T, ToolAllocator<T>>;
+template <typename T>
+using ToolDeque = std::deque<T, ToolAllocator<T>>;
+template <typename K, typename V>
+using ToolMap = std::map<K, V, std::less<K>, ToolAllocator<std::pair<const K, V>>>;
+template <typename K, typename V, typename Hash = std::hash<K>>
+using ToolUnorderedMap = std::unordered_map<K, V, Hash, std::equal_to<K>, ToolAllocator<std::pair<const K, V>>>;
+
+// Base of the tool's classes that are created with new: their objects live in the arena.
+// The destructor of polymorphic classes must be virtual, so that delete passes the right size.
+struct ToolAllocated {
+    static void* operator new(size_t size) { return toolArena.Allocate(size); }
+    static void* operator new[](size_t size) { return toolArena.Allocate(size); }
+    static void operator delete(void* mem, size_t size) { toolArena.Free(mem, size); }
+    static void operator delete[](void* mem, size_t size) { toolArena.Free(mem, size); }
+};
+
+// Create and destroy objects of other types (e.g. containers) in the arena.
+template <typename T, typename... Args>
+T* ToolNew(Args&&... args) {
+    return new (toolArena.Allocate(sizeof(T))) T(std::forward<Args>(args)...);
+}
+
+template <typename T>
+void ToolDelete(T* object) {
+    if (object == nullptr)
+        return;
+
+    object->~T();
+    toolArena.Free(object, sizeof(T));
+}
+
+template <typename T>
+T* ToolNewArray(size_t count) {
+    T* array = (T*)toolArena.Allocate(count * sizeof(T));
+    for (size_t i = 0; i < count; ++i)
+        new (&array[i]) T();
+    return array;
+}
+
+template <typename T>
+void ToolDeleteArray(T* array, size_t count) {
+    if (array == nullptr)
+        return;
+
+    for (size_t i = 0; i < count; ++i)
+        array[i].~T();
+    toolArena.Free(array, count * sizeof(T));
+}
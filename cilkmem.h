@@ -0,0 +1,24 @@
+#pragma once
+
+// Region annotations for programs analyzed by the tool. In dormant mode (MHWM_Dormant=1), the
+// hooks stay dormant outside of the regions: each region is a tracking window, with its own
+// SP DAG and its own high-water mark report. Without dormant mode the whole program is tracked
+// and the annotations are ignored.
+//
+// A region begins and ends in the same frame, where it has no outstanding children (before a
+// cilk_spawn or after a cilk_sync). An end between a cilk_spawn and its cilk_sync takes effect
+// at that cilk_sync. A region also ends when its frame returns. Regions don't nest.
+//
+// The functions are defined by the tool; they are weak here, so that an uninstrumented build
+// of the program links without them (check that they are non-null before calling them).
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+__attribute__((weak)) void cilkmem_region_begin(const char* name);
+__attribute__((weak)) void cilkmem_region_end(void);
+
+#ifdef __cplusplus
+}
+#endif
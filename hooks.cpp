@@ -1,68 +1,140 @@
 
 #include "hooks.h"
+#include "AllocationTable.h"
+#include "CSIMetadata.h"
 
-size_t currentLevel = 0;
+// Each worker keeps its own function level. It is restored from the
+// strand log whenever a worker resumes a stolen or synced frame.
+thread_local size_t currentLevel = 0;
 size_t mainLevel = 0;
 
-extern SPDAG* dag;
-
 bool started = false;
-bool inInstrumentation = false;
-uint32_t mainThread = 0;
+extern size_t windowLevel;
+
+CSIMetadata csiMetadata;
+
+extern bool stackMode;
+extern bool phases;
+extern bool samplingIterations;
+extern std::atomic<void*> iterationFrame;
+
+// Stack mode (MHWM_Stack): the frames of the instrumented functions that are live, keyed by
+// their frame address, with the bytes charged for them. A frame may return on another worker
+// than the one that entered it (once its continuation was stolen), so the table is shared.
+static AllocationTable stackFrames;
+
+// Charge 'size' bytes of stack (possibly negative) to the current edge of the calling worker.
+static inline void ChargeStack(int64_t size) {
+    SPEdgeData& edge = hookState.log->currentEdge;
+    edge.memAllocated += size;
+    if (edge.memAllocated > edge.maxMemAllocated)
+        edge.maxMemAllocated = edge.memAllocated;
+}
 
 
 extern "C" {
 
     void program_start();
     void program_exit();
+    void OnWindowFrameExit();
+    void OnWindowCallExit();
+    void OnIterationEntry(csi_id_t func_id, void* frame);
+    void OnIterationExit();
 
     void __csi_init() {}
 
+    // Called once the unit's front-end data tables were added, before main.
     void __csi_unit_init(const char * const file_name,
-        const instrumentation_counts_t counts) {}
+        const instrumentation_counts_t counts) {
+        csiMetadata.AddUnit(counts);
+    }
 
     __attribute__((noinline))   void __csi_func_entry(const csi_id_t func_id, const func_prop_t prop) {
-        inInstrumentation = true;
+        hookState.EnterInstrumentation();
 
-        char* functionName = __csi_get_func_source_loc(func_id)->name;
-
-        if (!started && functionName != nullptr && strcmp(functionName, "main") == 0)
+        if (!started && csiMetadata.IsMain(func_id))
         {
-            auto id = std::this_thread::get_id();
-            mainThread = *((uint32_t*)(&id));
             program_start();
             started = true;
             mainLevel = currentLevel + 1;
         }
+
+        // A call of the frame that opened the window may start an iteration: the saved frame
+        // pointer is the function's.
+        if (samplingIterations && currentLevel == windowLevel && hookState.log != nullptr)
+            OnIterationEntry(func_id, *(void**)__builtin_frame_address(0));
         
         if (started)
-        {
             currentLevel++;
-            dag->IncrementLevel();
+
+#ifdef USE_FUNC_PROFILE
+        if (hookState.log != nullptr)
+            hookState.log->AppendProfile(PROFILE_ENTRY, func_id);
+#endif
+
+        if (stackMode && started && hookState.log != nullptr)
+        {
+            // The frame of the function spans from its return address down to ours: the
+            // saved frame pointer is the function's, and our frame sits right below its own.
+            char* hookFrame = (char*)__builtin_frame_address(0);
+            char* frame = *(char**)hookFrame;
+            size_t size = frame - hookFrame;
+
+            stackFrames.Insert(frame, size, 0);
+            ChargeStack(size);
         }
 
-        inInstrumentation = false;
+        hookState.ExitInstrumentation();
     }
 
     __attribute__((always_inline)) void __csi_func_exit(const csi_id_t func_exit_id,
         const csi_id_t func_id, const func_exit_prop_t prop) {
 
-        inInstrumentation = true;
+        hookState.EnterInstrumentation();
 
-        char* functionName = __csi_get_func_source_loc(func_id)->name;
+        // Inlined into the function, so this is its frame.
+        uint32_t frameSize, stackId;
+        if (stackMode && hookState.log != nullptr && stackFrames.Take(__builtin_frame_address(0), frameSize, stackId))
+            ChargeStack(-(int64_t)frameSize);
 
-        if (currentLevel == mainLevel && functionName != nullptr && strcmp(functionName, "main") == 0)
+#ifdef USE_FUNC_PROFILE
+        if (hookState.log != nullptr)
+            hookState.log->AppendProfile(PROFILE_EXIT, func_id);
+#endif
+
+        if (iterationFrame.load(std::memory_order_relaxed) == __builtin_frame_address(0))
+            OnIterationExit();
+
+        if (currentLevel == mainLevel && csiMetadata.IsMain(func_id))
         {
             program_exit();
             started = false;
         }
+        else if (currentLevel == windowLevel && hookState.log != nullptr) // The frame that opened the window returns.
+            OnWindowFrameExit();
+        else if (phases && currentLevel == windowLevel + 1 && hookState.log != nullptr)
+            OnWindowCallExit();
         
         if (started)
-        {
-            dag->DecrementLevel();
             currentLevel--;
-        }
 
-        inInstrumentation = false;
+        hookState.ExitInstrumentation();
+    }
+
+    // Dynamic allocas (and VLAs) are charged to their function's frame until it returns, like
+    // alloca() memory, even when a VLA goes out of scope sooner. Static ones are part of the frame.
+    __attribute__((always_inline)) void __csi_after_alloca(const csi_id_t alloca_id, const void* addr,
+        size_t num_bytes, const alloca_prop_t prop) {
+
+        if (!stackMode || prop.is_static || hookState.log == nullptr)
+            return;
+
+        void* frame = __builtin_frame_address(0);
+        uint32_t frameSize, stackId;
+        if (!stackFrames.Take(frame, frameSize, stackId))
+            return;
+
+        ChargeStack(num_bytes);
+        stackFrames.Insert(frame, frameSize + num_bytes, 0);
     }
 }
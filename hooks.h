@@ -8,8 +8,9 @@
 #include <cstring>
 #include "SeriesParallelDAG.h"
 #include "SPEdgeProducer.h"
+#include "SPStrandLog.h"
+#include "HookState.h"
 #include <cxxabi.h>
 #include <memory>
 #include <cassert>
-#include <csi/csi.h>
 #include "common.h"
\ No newline at end of file
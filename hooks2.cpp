@@ -1,9 +1,23 @@
 
 #include "hooks.h"
+#include "StackDepot.h"
+#include "AllocatorModel.h"
+#include "CSIMetadata.h"
+#include "cilkmem.h"
+#ifdef USE_FUNC_PROFILE
+#include "FunctionProfile.h"
+#endif
 #include <thread>
 #include <stdlib.h>
 #include <cstring>
 #include <fstream>
+#include <mutex>
+#include <atomic>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <cmath>
+#include <algorithm>
 
 
 bool fullSPDAG = true;
@@ -14,12 +28,26 @@ bool debugVerbose = false;
 bool showSource = true;
 bool outputDAG = true;
 bool orderSourceMap = false;
+bool residentMode = false;
+bool stackMode = false;
+bool dormant = false;
+bool phases = false;
+bool controlSignals = false;
 
 std::string outputFile = "";
+std::string recordFile = "";
+std::string profileFile = "profile";
+size_t recordSize = 1024;
+std::string allocatorModelName = "";
+// -1 keeps the default of the allocator model.
+int64_t workerOverhead = -1;
 
 int64_t memLimit = 10000;
 size_t p = 2;
 size_t minSizeBacktrace = 10 * 1000 * 1000;
+size_t sampleRate = 0;
+size_t stackDepth = 1;
+size_t startAtSpawn = 0;
 
 std::string programName = "";
 
@@ -27,13 +55,86 @@ std::string programName = "";
 OutputPrinter out{ std::cout };
 OutputPrinter alwaysOut{ std::cout };
 SPDAG* dag = nullptr;
-SPEdgeData currentEdge;
 
-extern size_t currentLevel;
-extern bool inInstrumentation;
+#ifdef USE_FUNC_PROFILE
+FunctionProfile functionProfile;
+#endif
+
+extern thread_local size_t currentLevel;
+
+// Continuations that may be stolen. A worker keeps those of its spawns on its own stack, and
+// resumes them from there unless they were stolen: the thief claims them from the stack of its
+// victim. Spawns nested deeper than a stack holds go to the map, keyed by the frame of the
+// spawning function.
+std::atomic<ContinuationStack*> continuationStacks{ nullptr };
+thread_local ContinuationStack* continuationStack = nullptr;
+SPStrandLogMap pendingContinuations;
+std::atomic<size_t> numPendingInMap{ 0 };
+// Frames suspended at a sync, keyed by their has_spawned flag.
+SPStrandLogMap suspendedSyncs;
+
+// First strand log that hasn't been replayed into the DAG yet.
+SPStrandLog* replayLog = nullptr;
+std::mutex replayMutex;
 
 std::thread* aggregatingThread = nullptr;
 
+// Resident mode: /proc/self/statm, and the resident set size when a strand was last charged.
+int statmFd = -1;
+std::atomic<int64_t> lastResident{ 0 };
+
+// Runtime control of tracking. The program is tracked in windows: by default a single one,
+// from main to its exit. In dormant mode (MHWM_Dormant) the hooks only check whether a
+// window was requested (MHWM_StartAtSpawn, SIGUSR1), and the window opens at the next
+// spawn or sync of a frame that has no outstanding children. It closes on SIGUSR2 at
+// such a point of the frame that opened it, when that frame returns, or at program exit.
+enum TrackingRequest : int {
+    REQUEST_NONE,
+    REQUEST_START,
+    REQUEST_STOP,
+    REQUEST_COUNT_SPAWNS, // Counting the spawns up to MHWM_StartAtSpawn.
+};
+
+std::atomic<int> trackingRequest{ REQUEST_NONE };
+std::atomic<bool> windowOpen{ false };
+std::atomic<size_t> dormantSpawns{ 0 };
+// Function level of the frame that opened the window.
+size_t windowLevel = 0;
+size_t numWindows = 0;
+// Whether cilkmem_region_begin opened the window, and the name of its region.
+bool regionWindow = false;
+std::string windowName = "";
+
+// Phases (MHWM_Phases): the DAG so far is aggregated, reported and freed at the points where
+// no strand is outstanding, and the window continues with a new one. These are the syncs of
+// the frame that opened the window, and the syncs and returns of the functions it calls while
+// it has no outstanding children, like the calls of stress(n) in the loops of test.cpp. A
+// return only ends a phase that spawned, so that serial calls don't make phases of their own.
+// The components of the phases, in series, give the high-water marks of the whole window.
+size_t numPhases = 0;
+std::atomic<bool> phaseSpawned{ false };
+SPNaiveComponent* windowNaive = nullptr;
+SPComponent windowComponent;
+
+// Sampled iterations (MHWM_SampleIterations, MHWM_FirstIterations): an iteration is a call made
+// by the frame that opened the window while it has no outstanding children, like the calls of
+// stress(n) in the loops of test.cpp. Every iteration is a segment of the window, combined in
+// series like the phases. Only the sampled ones are tracked: the others run with the hooks
+// dormant, and count as the last sampled iteration of the same function.
+size_t sampleIterations = 0;
+size_t firstIterations = 0;
+bool samplingIterations = false;
+size_t numIterations = 0;
+size_t numSampledIterations = 0;
+// Whether the frame that opened the window has outstanding children. Read by any worker.
+std::atomic<bool> windowSpawned{ false };
+// Frame of the function of the current iteration, if any. Read by any worker at function exits.
+std::atomic<void*> iterationFrame{ nullptr };
+csi_id_t iterationFunc = 0;
+std::atomic<bool> iterationSampled{ false };
+ToolMap<csi_id_t, SPNaiveComponent> sampledNaive;
+ToolMap<csi_id_t, SPComponent> sampledComponents;
+
 template <typename T>
 void SetOption(T* option, const char* envVarName) {
     char* string = getenv(envVarName);
@@ -80,13 +181,6 @@ void SetOption(bool* option, const char* envVarName, const char* trueString, con
 }
 
 void GetOptionsFromEnvironment() {
-    char* cilkWorkers = getenv("CILK_NWORKERS");
-    if (cilkWorkers == nullptr || strcmp(cilkWorkers, "1") != 0)
-    {
-        alwaysOut << "ERROR: To run the tool you must set CILK_NWORKERS=1\n";
-        exit(-1);
-    }
-
     SetOption(&fullSPDAG, "MHWM_FullSPDAG", "1", "0");
     SetOption(&runOnline, "MHWM_Online", "1", "0");
     SetOption(&runEfficient, "MHWM_Efficient", "1", "0");
@@ -97,173 +191,773 @@ void GetOptionsFromEnvironment() {
     SetOption(&memLimit, "MHWM_MemLimit");
     SetOption(&p, "MHWM_NumProcessors");
     SetOption(&orderSourceMap, "MHWM_OrderSourceMap", "1", "0");
+    SetOption(&residentMode, "MHWM_Resident", "1", "0");
+    SetOption(&stackMode, "MHWM_Stack", "1", "0");
+    SetOption(&dormant, "MHWM_Dormant", "1", "0");
+    SetOption(&phases, "MHWM_Phases", "1", "0");
+    SetOption(&sampleIterations, "MHWM_SampleIterations");
+    SetOption(&firstIterations, "MHWM_FirstIterations");
+    SetOption(&startAtSpawn, "MHWM_StartAtSpawn");
+    SetOption(&controlSignals, "MHWM_Signals", "1", "0");
     SetOption(outputFile, "MHWM_OutputFile");
+    SetOption(recordFile, "MHWM_RecordFile");
+    SetOption(profileFile, "MHWM_ProfileFile");
+    SetOption(&recordSize, "MHWM_RecordSize");
+    SetOption(allocatorModelName, "MHWM_AllocatorModel");
+    SetOptionZeroAllowed(&workerOverhead, "MHWM_WorkerOverhead");
     SetOption(programName, "MHWM_ProgramName");
 
     SetOptionZeroAllowed(&minSizeBacktrace, "MHWM_BacktraceThreshold");
+    SetOption(&sampleRate, "MHWM_SampleRate");
+    SetOption(&stackDepth, "MHWM_StackDepth");
 
     if (p <= 0)
     {
         alwaysOut << "ERROR: p must be set to a positive value\n";
         exit(-1);
     }
-}
 
-extern "C" {
+    if (startAtSpawn > 0)
+        dormant = true;
 
-    void AggregateComponentsOnline() {
-        int64_t threshold = memLimit / (2 * p);
+    samplingIterations = sampleIterations > 0 || firstIterations > 0;
 
-        SPEdgeProducer* producer = nullptr;
-        SPEventBareboneOnlineProducer* eventProducer = nullptr;
+#ifdef NO_FUNC_HOOKS
+    if (stackMode || dormant || phases || samplingIterations)
+    {
+        alwaysOut << "ERROR: MHWM_Stack, MHWM_Dormant, MHWM_Phases and sampled iterations need the function entries and exits to be instrumented\n";
+        exit(-1);
+    }
+#endif
 
+    if (samplingIterations && phases)
+    {
+        alwaysOut << "ERROR: sampled iterations can't be combined with MHWM_Phases\n";
+        exit(-1);
+    }
 
-        if (fullSPDAG)
-            producer = new SPEdgeFullOnlineProducer{ static_cast<FullSPDAG*>(dag) };
-        else
+    if (samplingIterations && recordFile != "")
+    {
+        alwaysOut << "ERROR: sampled iterations can't be combined with MHWM_RecordFile, which can't replay the iterations that aren't tracked\n";
+        exit(-1);
+    }
+
+    if (stackMode && residentMode)
+    {
+        alwaysOut << "ERROR: MHWM_Stack can't be combined with MHWM_Resident, whose resident set already includes the stacks\n";
+        exit(-1);
+    }
+
+    // The resident set is the process', so with several workers no strand can be charged its own change.
+    if (residentMode)
+    {
+        const char* numWorkers = getenv("CILK_NWORKERS");
+        long workers = numWorkers != nullptr ? atol(numWorkers) : sysconf(_SC_NPROCESSORS_ONLN);
+        if (workers > 1)
         {
-            producer = new SPEdgeBareboneOnlineProducer{ static_cast<BareboneSPDAG*>(dag) };
-            eventProducer = new SPEventBareboneOnlineProducer{ static_cast<BareboneSPDAG*>(dag) };
+            alwaysOut << "ERROR: MHWM_Resident needs a single worker (CILK_NWORKERS=1)\n";
+            exit(-1);
         }
+    }
+
+    if (allocatorModelName != "")
+    {
+        if (!allocatorModel.Select(allocatorModelName.c_str()))
+        {
+            alwaysOut << "ERROR: unknown allocator model " << allocatorModelName << " (expected glibc, jemalloc, tcmalloc or none)\n";
+            exit(-1);
+        }
+
+        if (workerOverhead >= 0)
+            allocatorModel.SetWorkerOverhead(workerOverhead);
+    }
+}
 
+// Resident set size of the process, in bytes.
+int64_t ReadResidentBytes() {
+    char buffer[128];
+    ssize_t length = pread(statmFd, buffer, sizeof(buffer) - 1, 0);
+    if (length <= 0)
+        return lastResident.load(std::memory_order_relaxed);
+    buffer[length] = '\0';
+
+    // The second field is the number of resident pages.
+    char* end = nullptr;
+    std::strtoll(buffer, &end, 10);
+    return std::strtoll(end, nullptr, 10) * sysconf(_SC_PAGESIZE);
+}
+
+// In resident mode, charge the change of the resident set since the last spawn or
+// sync point to the strand that is ending (there is a single worker).
+void ChargeResidency(SPStrandLog* log) {
+    if (!residentMode)
+        return;
+
+    int64_t resident = ReadResidentBytes();
+    int64_t change = resident - lastResident.exchange(resident, std::memory_order_relaxed);
+
+    SPEdgeData& edge = log->currentEdge;
+    edge.memAllocated += change;
+    if (edge.memAllocated > edge.maxMemAllocated)
+        edge.maxMemAllocated = edge.memAllocated;
+}
+
+// Make 'log' the log the calling worker records into.
+void SetStrandLog(SPStrandLog* log) {
+    hookState.SetLog(log);
+    if (residentMode)
+        hookState.flags |= HOOK_RESIDENT;
+}
+
+#ifdef NO_FUNC_HOOKS
+extern "C" void program_exit();
+extern bool started;
+
+bool exitHandlerRegistered = false;
+
+// Without function hooks, tracking stops when the program exits: the thread that returned
+// from main runs the exit handlers with the last strand log. Registered at the first spawn,
+// after the static initialization of every unit, so that the handler runs before the globals
+// the aggregation uses are destroyed.
+__attribute__((noinline)) void RegisterExitHandler() {
+    exitHandlerRegistered = true;
+    atexit([] {
+        hookState.EnterInstrumentation();
+        program_exit();
+        started = false;
+        hookState.ExitInstrumentation();
+    });
+}
+#endif
+
+// SIGUSR1 requests a window, SIGUSR2 closes it (MHWM_Signals).
+void OnControlSignal(int signal) {
+    trackingRequest.store(signal == SIGUSR1 ? REQUEST_START : REQUEST_STOP, std::memory_order_relaxed);
+}
+
+#ifdef USE_SPAWN_SITES
+std::string GetSiteName(uint32_t site) {
+    static const char* kinds[] = { "start", "spawn", "continuation", "sync" };
+    if (site == 0)
+        return kinds[CSIMetadata::SITE_START];
+
+    const CSIMetadata::SourceLocation& location = csiMetadata.GetSite(site);
+    std::string name = kinds[CSIMetadata::GetSiteKind(site)];
+    if (location.name != nullptr)
+        return name + " " + location.name + ":" + std::to_string(location.line);
+    return name + " ??";
+}
+#endif
+
+#ifdef USE_SOURCE_MAPS
+// When sampling, a sampled allocation of weight w adds at most w * sampleRate to the
+// variance of its source's estimate B, so the variance of B is at most B * sampleRate.
+// Print the 95% confidence interval that bound gives.
+void PrintSourceLine(const std::pair<const std::string, int64_t>& source) {
+    alwaysOut << "[" << source.first << "]: " << source.second;
+
+    if (sampleRate > 0)
+    {
+        double stdDev = std::sqrt((double)std::max<int64_t>(source.second, 0) * sampleRate);
+        alwaysOut << " (+/- " << (int64_t)(1.96 * stdDev) << " at 95%)";
+    }
+
+    alwaysOut << "\n";
+}
+#endif
+
+extern "C" void AggregateComponentsOnline();
+
+// Replay of the events of a closed strand log into the DAG, specialized for the kind of DAG
+// and the options that change the work done per event, so that the DAG is called directly
+// and the options aren't checked per event. Selected when tracking starts.
+template <class DAG, bool ONLINE, bool SOURCE>
+void ReplayEvents(SPStrandLog* log) {
+    DAG* spdag = static_cast<DAG*>(dag);
+
+    for (SPStrandEvent& event : log->events)
+    {
+        spdag->SetLevel(event.level);
+
+        if (event.edgeId != 0)
+            allocationRecorder.AppendEdgeEnd(event.spawn, event.edgeId, event.regionId, event.level);
+
+        if (event.spawn)
+            spdag->Spawn(event.data, event.regionId);
+        else
+            spdag->Sync(event.data, event.regionId);
+
+        if (SOURCE && event.locationName != nullptr)
+            spdag->SetLastNodeLocation(event.locationName, event.locationLine);
+
+        if (ONLINE && event.spawn && !aggregatingThread) // Start aggregation online.
+            aggregatingThread = new std::thread{ AggregateComponentsOnline };
+    }
+}
+
+typedef void (*ReplayEventsFunction)(SPStrandLog* log);
+
+ReplayEventsFunction replayEvents = nullptr;
+
+template <class DAG>
+ReplayEventsFunction SelectReplayEvents() {
+    if (runOnline)
+        return showSource ? ReplayEvents<DAG, true, true> : ReplayEvents<DAG, true, false>;
+    else
+        return showSource ? ReplayEvents<DAG, false, true> : ReplayEvents<DAG, false, false>;
+}
+
+extern "C" {
+
+    void GetAllocationTableStats(size_t* liveEntries, size_t* reservedBytes);
+
+    // Print the high-water marks for every number of processors up to p (naive algorithm).
+    void ReportNaive(SPNaiveComponent& aggregated) {
         int64_t watermark = 0;
-        int64_t watermarkCompare = memLimit / 2;
 
-        if (!runNaive && runEfficient)
+        std::ofstream* file = nullptr;
+        if (outputFile != "")
         {
-            auto aggregated = dag->AggregateComponentsEfficient(producer, eventProducer, threshold);
-            aggregated.Print();
-            watermark = aggregated.GetWatermark(threshold);
+            file = new std::ofstream{ outputFile };
         }
-        else if (runNaive)
+
+        for (size_t i = 1; i <= p; ++i)
         {
-            SPNaiveComponent aggregated{ p };
-            if (runEfficient)
-            {
-                aggregated = dag->AggregateComponentsNaiveEfficient(producer, eventProducer, threshold, p);
-            }
-            else
-            {
-                aggregated = dag->AggregateComponentsNaive(producer, eventProducer, threshold, p);
-            }
+            watermark = aggregated.GetWatermark(i);
 
-            std::ofstream* file = nullptr;
-            if (outputFile != "")
+            if (file && *file)
             {
-                file = new std::ofstream{ outputFile };
+                *file << "Memory high-water mark for p = " << i << " : " << watermark << "\n";
             }
 
-            for (size_t i = 1; i <= p; ++i)
+            alwaysOut << "Memory high-water mark for p = " << i << " : " << watermark << "\n";
+
+            if (allocatorModel.IsActive())
             {
-                watermark = aggregated.GetWatermark(i);
+                int64_t expectedResident = aggregated.GetWatermark(i, allocatorModel.GetWorkerOverhead());
 
                 if (file && *file)
                 {
-                    *file << "Memory high-water mark for p = " << i << " : " << watermark << "\n";
+                    *file << "Expected RSS for p = " << i << " : " << expectedResident << "\n";
                 }
 
-                alwaysOut << "Memory high-water mark for p = " << i << " : " << watermark << "\n";
+                alwaysOut << "Expected RSS for p = " << i << " : " << expectedResident << " (" << allocatorModel.GetName()
+                    << " model, " << allocatorModel.GetWorkerOverhead() << " bytes per worker)\n";
+            }
+
+#ifdef USE_SOURCE_MAPS
+
+            alwaysOut << "Source map for p = " << i << ":\n";
 
+            // Print the stacks (or sites) by name, in the same order as before they were interned.
+            std::map<std::string, int64_t> namedMap;
+            for (const auto& keyVal : aggregated.GetSourceMap(i)) {
 #ifdef USE_BACKTRACE
+                namedMap[GetStackName(keyVal.first)] += keyVal.second;
+#else
+                namedMap[GetSiteName(keyVal.first)] += keyVal.second;
+#endif
+            }
 
-                alwaysOut << "Source map for p = " << i << ":\n";
-                if (!orderSourceMap) {
-                    for (const auto& keyVal : aggregated.GetSourceMap(i)) {
-                        alwaysOut << "[" << keyVal.first << "]: " << keyVal.second << "\n";
-                    }
+            if (!orderSourceMap) {
+                for (const auto& keyVal : namedMap) {
+                    PrintSourceLine(keyVal);
                 }
-                else {
-                    SourceMap& map = aggregated.GetSourceMap(i);
-                    auto cmp = [](const SourceMap::value_type & p1, const SourceMap::value_type & p2)
-                    {
-                        return p2.second < p1.second;
-                    };
-
-                    std::set < SourceMap::value_type, decltype(cmp)> orderedSet(map.begin(), map.end(), cmp);
-                    for (const auto& keyVal : orderedSet)
-                    {
-                        alwaysOut << "[" << keyVal.first << "]: " << keyVal.second << "\n";
-                    }
+            }
+            else {
+                auto cmp = [](const std::pair<const std::string, int64_t> & p1, const std::pair<const std::string, int64_t> & p2)
+                {
+                    return p2.second < p1.second;
+                };
 
+                std::set < std::pair<const std::string, int64_t>, decltype(cmp)> orderedSet(namedMap.begin(), namedMap.end(), cmp);
+                for (const auto& keyVal : orderedSet)
+                {
+                    PrintSourceLine(keyVal);
                 }
 
-#endif
             }
 
+#endif
+        }
 
 
 
-            if (file)
-            {
-                file->close();
-                delete file;
-            }
 
-            watermarkCompare = memLimit;
+        if (file)
+        {
+            file->close();
+            delete file;
+        }
+    }
+
+    // Print the high-water mark for p processors, and compare it against the memory limit.
+    void ReportComponent(SPComponent& aggregated, int64_t threshold) {
+        aggregated.Print();
+
+        int64_t watermark = aggregated.GetWatermark(threshold);
+        int64_t watermarkCompare = memLimit / 2;
+
+        alwaysOut << "Memory high-water mark: " << watermark << "\n";
+        if (allocatorModel.IsActive())
+        {
+            alwaysOut << "Expected RSS: " << watermark + (int64_t)p * allocatorModel.GetWorkerOverhead() << " (" << allocatorModel.GetName()
+                << " model, " << allocatorModel.GetWorkerOverhead() << " bytes per worker)\n";
+        }
+        if (watermark <= watermarkCompare)
+        {
+            alwaysOut << "The real high-water mark is LESS than " << memLimit << " bytes\n";
         }
         else
         {
-            auto aggregated = dag->AggregateComponents(producer, eventProducer, threshold);
-            aggregated.Print();
-            watermark = aggregated.GetWatermark(threshold);
+            alwaysOut << "The real high-water mark is AT LEAST " << watermarkCompare << " bytes\n";
         }
+    }
+
+    void AggregateComponentsOnline() {
+        int64_t threshold = memLimit / (2 * p);
 
-        if (!runNaive)
+        SPEdgeProducer* producer = nullptr;
+        SPEventBareboneOnlineProducer* eventProducer = nullptr;
+
+
+        if (fullSPDAG)
+            producer = new SPEdgeFullOnlineProducer{ static_cast<FullSPDAG*>(dag) };
+        else
+        {
+            producer = new SPEdgeBareboneOnlineProducer{ static_cast<BareboneSPDAG*>(dag) };
+            eventProducer = new SPEventBareboneOnlineProducer{ static_cast<BareboneSPDAG*>(dag) };
+        }
+
+        if (runNaive)
         {
-            alwaysOut << "Memory high-water mark: " << watermark << "\n";
-            if (watermark <= watermarkCompare)
+            SPNaiveComponent aggregated{ p };
+            if (runEfficient)
             {
-                alwaysOut << "The real high-water mark is LESS than " << memLimit << " bytes\n";
+                aggregated = dag->AggregateComponentsNaiveEfficient(producer, eventProducer, threshold, p);
             }
             else
             {
-                alwaysOut << "The real high-water mark is AT LEAST " << watermarkCompare << " bytes\n";
+                aggregated = dag->AggregateComponentsNaive(producer, eventProducer, threshold, p);
+            }
+
+            if (phases || samplingIterations)
+            {
+                // The segments of a window run one after the other.
+                if (windowNaive == nullptr)
+                    windowNaive = new SPNaiveComponent{ p };
+                windowNaive->CombineSeries(aggregated);
+            }
+
+            if (!samplingIterations)
+                ReportNaive(aggregated);
+            else if (iterationSampled.load(std::memory_order_relaxed))
+            {
+                sampledNaive.erase(iterationFunc);
+                sampledNaive.emplace(iterationFunc, std::move(aggregated));
             }
         }
+        else
+        {
+            SPComponent aggregated;
+            if (runEfficient)
+                aggregated = dag->AggregateComponentsEfficient(producer, eventProducer, threshold);
+            else
+                aggregated = dag->AggregateComponents(producer, eventProducer, threshold);
 
+            if (phases || samplingIterations)
+                windowComponent.CombineSeries(aggregated);
+
+            if (!samplingIterations)
+                ReportComponent(aggregated, threshold);
+            else if (iterationSampled.load(std::memory_order_relaxed))
+                sampledComponents[iterationFunc] = aggregated;
+        }
 
         delete producer;
         delete eventProducer;
     }
 
-    void program_start() {
-        GetOptionsFromEnvironment();
-        out.SetActive(debugVerbose);
+    // Feed the closed strand logs to the DAG, in serial order. Must be called with replayMutex held.
+    void ReplayStrandLogs() {
+        while (replayLog != nullptr && replayLog->IsClosed())
+        {
+            SPStrandLog* log = replayLog;
+            replayEvents(log);
+
+#ifdef USE_FUNC_PROFILE
+            functionProfile.AddRecords(log->profile);
+#endif
+
+            replayLog = log->next;
+            delete log;
+        }
+    }
+
+    // Replay whatever is ready, unless another worker is already doing it.
+    void TryReplayStrandLogs() {
+        std::unique_lock<std::mutex> lock(replayMutex, std::try_to_lock);
+        if (lock.owns_lock())
+            ReplayStrandLogs();
+    }
 
+    // Create the DAG of a window or phase, and the log of the calling worker's strand.
+    void StartDAG() {
         if (!dag)
         {
             if (fullSPDAG)
+            {
                 dag = new FullSPDAG(out);
+                replayEvents = SelectReplayEvents<FullSPDAG>();
+            }
             else
+            {
                 dag = new BareboneSPDAG(out);
+                replayEvents = SelectReplayEvents<BareboneSPDAG>();
+            }
         }
+
+        replayLog = new SPStrandLog();
+        SetStrandLog(replayLog);
     }
 
-    void program_exit() {
-        OUTPUT(out << "Exiting program\n");
+    // Open a window on the calling worker, in a frame at function level 'level' that has no outstanding children.
+    // The caller claimed it by setting windowOpen.
+    void StartTracking(size_t level) {
+        OUTPUT(out << "Starting tracking at level " << level << "\n");
+
+        if (residentMode)
+            lastResident = ReadResidentBytes();
+
+        windowLevel = level;
+        windowSpawned.store(false, std::memory_order_relaxed);
+        numWindows++;
+
+        StartDAG();
+    }
 
+    void program_start() {
+        GetOptionsFromEnvironment();
+        out.SetActive(debugVerbose);
+
+        if (residentMode)
+            statmFd = open("/proc/self/statm", O_RDONLY);
+
+        // Before the first log is created, so that every edge gets a recording id.
+        if (recordFile != "" && !allocationRecorder.Open(recordFile.c_str(), recordSize << 20))
+        {
+            alwaysOut << "ERROR: cannot create the allocation recording " << recordFile << "\n";
+            exit(-1);
+        }
+
+        if (controlSignals)
+        {
+            struct sigaction action = {};
+            action.sa_handler = OnControlSignal;
+            sigemptyset(&action.sa_mask);
+            sigaction(SIGUSR1, &action, nullptr);
+            sigaction(SIGUSR2, &action, nullptr);
+        }
+
+        // main is entered right after this.
+        if (!dormant)
+        {
+            windowOpen.store(true, std::memory_order_relaxed);
+            StartTracking(currentLevel + 1);
+        }
+        else if (startAtSpawn > 0)
+            trackingRequest.store(REQUEST_COUNT_SPAWNS, std::memory_order_relaxed);
+    }
+
+    // Called by a worker that isn't tracking, at a spawn or sync, when a request is pending.
+    // 'canStart' tells whether its frame has no outstanding children.
+    __attribute__((noinline)) void OnDormantPoint(bool spawn, bool canStart) {
+        int request = trackingRequest.load(std::memory_order_relaxed);
+
+        if (request == REQUEST_COUNT_SPAWNS)
+        {
+            if (!spawn || dormantSpawns.fetch_add(1, std::memory_order_relaxed) + 1 < startAtSpawn)
+                return;
+
+            trackingRequest.compare_exchange_strong(request, REQUEST_START, std::memory_order_relaxed);
+            request = REQUEST_START;
+        }
+
+        if (request == REQUEST_STOP && !windowOpen.load(std::memory_order_relaxed))
+            trackingRequest.compare_exchange_strong(request, REQUEST_NONE, std::memory_order_relaxed);
+
+        // A single worker claims the request, then the window, which has to be closed before
+        // another one opens (a region may have claimed it in between).
+        if (request == REQUEST_START && canStart && !windowOpen.load(std::memory_order_relaxed) &&
+            trackingRequest.compare_exchange_strong(request, REQUEST_NONE, std::memory_order_relaxed))
+        {
+            bool closed = false;
+            if (!windowOpen.compare_exchange_strong(closed, true, std::memory_order_relaxed))
+            {
+                // Keep the request pending, unless another one replaced it.
+                int none = REQUEST_NONE;
+                trackingRequest.compare_exchange_strong(none, REQUEST_START, std::memory_order_relaxed);
+                return;
+            }
+
+            hookState.EnterInstrumentation();
+            StartTracking(currentLevel);
+            hookState.ExitInstrumentation();
+        }
+    }
+
+    // End the strand of the calling worker with a synthetic sync, and replay the logs: the DAG
+    // is then complete. Must be called in the frame that opened the window, with no outstanding children.
+    void CompleteDAG() {
         // Simulate a final sync.
-        dag->Sync(currentEdge, 0);
+        SPStrandLog* log = hookState.log;
+        ChargeResidency(log);
+        log->Append(false, 0, currentLevel, nullptr, 0);
+        log->Close(nullptr);
+        SetStrandLog(nullptr);
 
+        {
+            std::lock_guard<std::mutex> lock(replayMutex);
+            ReplayStrandLogs();
+        }
+
+        DEBUG_ASSERT(replayLog == nullptr);
         DEBUG_ASSERT(dag->IsComplete());
+    }
 
+    // Aggregate the complete DAG, report its high-water marks and free it.
+    void AggregateDAG() {
         // Print out the Series Parallel dag.
         // dag->Print();
 
         if (outputDAG && !runOnline && fullSPDAG)
             dag->WriteDotFile("sp.dot");
 
-        if (!runOnline)
+        // Online, the aggregation starts at the first spawn.
+        if (!aggregatingThread)
         {
             aggregatingThread = new std::thread{ AggregateComponentsOnline };
 
             // AggregateComponentsOnline();
         }
 
-        if (aggregatingThread)
-            aggregatingThread->join();
+        aggregatingThread->join();
 
         delete dag;
+        dag = nullptr;
+        delete aggregatingThread;
+        aggregatingThread = nullptr;
+    }
+
+    __attribute__((noinline)) void EndPhase() {
+        OUTPUT(out << "Ending phase\n");
+
+        CompleteDAG();
+        if (allocationRecorder.IsActive())
+            allocationRecorder.AppendBoundary(RECORD_PHASE_END);
+
+        numPhases++;
+        phaseSpawned.store(false, std::memory_order_relaxed);
+        alwaysOut << "Phase " << numPhases << ":\n";
+        AggregateDAG();
+
+        StartDAG();
+    }
+
+    // End the phase when a call of the window's frame returns (checked by __csi_func_exit), unless
+    // the window's frame has outstanding children or the phase didn't spawn.
+    __attribute__((noinline)) void OnWindowCallExit() {
+        if (!windowSpawned.load(std::memory_order_relaxed) && phaseSpawned.load(std::memory_order_relaxed))
+            EndPhase();
+    }
+
+    // Start an iteration at the entry of a call of the window's frame, 'frame' being the frame of
+    // the callee (checked by __csi_func_entry). The segment before it ends there.
+    __attribute__((noinline)) void OnIterationEntry(csi_id_t funcId, void* frame) {
+        if (windowSpawned.load(std::memory_order_relaxed))
+            return;
+
+        OUTPUT(out << "Starting iteration " << numIterations << "\n");
+
+        size_t index = numIterations++;
+        bool sampled = index < firstIterations || (sampleIterations > 0 && index % sampleIterations == 0);
+
+        // The first iteration of a function has nothing to stand for it.
+        if (runNaive ? sampledNaive.count(funcId) == 0 : sampledComponents.count(funcId) == 0)
+            sampled = true;
+
+        CompleteDAG();
+        AggregateDAG();
+
+        iterationFrame.store(frame, std::memory_order_relaxed);
+        iterationFunc = funcId;
+        iterationSampled.store(sampled, std::memory_order_relaxed);
+
+        if (sampled)
+        {
+            numSampledIterations++;
+            StartDAG();
+        }
+    }
+
+    // End the current iteration when its function returns (checked by __csi_func_exit), on
+    // whichever worker returns from it.
+    __attribute__((noinline)) void OnIterationExit() {
+        OUTPUT(out << "Ending iteration\n");
+
+        iterationFrame.store(nullptr, std::memory_order_relaxed);
+
+        // The worker may not have followed the levels of an iteration that wasn't tracked.
+        currentLevel = windowLevel + 1;
+
+        if (iterationSampled.load(std::memory_order_relaxed))
+        {
+            CompleteDAG();
+            AggregateDAG();
+            iterationSampled.store(false, std::memory_order_relaxed);
+        }
+        else if (runNaive)
+            windowNaive->CombineSeries(sampledNaive.at(iterationFunc));
+        else
+            windowComponent.CombineSeries(sampledComponents.at(iterationFunc));
+
+        StartDAG();
+    }
+
+    // Close the window of the calling worker with a synthetic sync, and report its high-water marks.
+    // Must be called in the frame that opened the window, with no outstanding children.
+    void StopTracking() {
+        OUTPUT(out << "Stopping tracking\n");
+
+        CompleteDAG();
+        if (allocationRecorder.IsActive())
+            allocationRecorder.AppendBoundary(RECORD_WINDOW_END);
+
+        if (dormant || controlSignals)
+        {
+            alwaysOut << "Tracked window " << numWindows;
+            if (windowName != "")
+                alwaysOut << " (" << windowName << ")";
+            alwaysOut << ":\n";
+        }
+
+        if (phases && numPhases > 0)
+        {
+            numPhases++;
+            alwaysOut << "Phase " << numPhases << ":\n";
+        }
+
+        AggregateDAG();
+
+        if (phases && numPhases > 0)
+            alwaysOut << "Whole window (" << numPhases << " phases):\n";
+        else if (samplingIterations)
+            alwaysOut << "Iterations: " << numIterations << " (" << numSampledIterations << " sampled)\n";
+
+        if ((phases && numPhases > 0) || samplingIterations)
+        {
+            if (windowNaive != nullptr)
+                ReportNaive(*windowNaive);
+            else
+                ReportComponent(windowComponent, memLimit / (2 * p));
+        }
+
+        numPhases = 0;
+        delete windowNaive;
+        windowNaive = nullptr;
+        windowComponent = SPComponent();
+
+        numIterations = 0;
+        numSampledIterations = 0;
+        iterationFrame.store(nullptr, std::memory_order_relaxed);
+        iterationSampled.store(false, std::memory_order_relaxed);
+        sampledNaive.clear();
+        sampledComponents.clear();
+
+#ifdef USE_FUNC_PROFILE
+        functionProfile.Write(profileFile, p);
+        functionProfile.Clear();
+#endif
+
+        size_t liveEntries = 0;
+        size_t reservedBytes = 0;
+        GetAllocationTableStats(&liveEntries, &reservedBytes);
+        if (liveEntries > 0)
+        {
+            OUTPUT(out << "Allocation metadata: " << liveEntries << " live allocations, " << reservedBytes << " bytes reserved\n");
+        }
+
+        regionWindow = false;
+        windowName = "";
+        windowOpen.store(false, std::memory_order_relaxed);
+    }
+
+    // Called by the worker that returns from main.
+    void program_exit() {
+        OUTPUT(out << "Exiting program\n");
+
+        if (windowOpen.load(std::memory_order_relaxed) && hookState.log != nullptr)
+            StopTracking();
+
+        // The recording spans every window of the run.
+        if (allocationRecorder.IsActive())
+        {
+            allocationRecorder.Close();
+            if (allocationRecorder.GetClaimed() > allocationRecorder.GetCapacity())
+                alwaysOut << "WARNING: the allocation recording " << recordFile << " wrapped around, increase MHWM_RecordSize\n";
+
+#ifdef USE_BACKTRACE
+            // Names of the stack ids of the records, for the lifetime report of allocationreplay.
+            std::ofstream sites{ recordFile + ".sites" };
+            for (uint32_t stackId = 1; stackId < GetNumStacks(); ++stackId)
+                sites << stackId << "\t" << GetStackName(stackId) << "\n";
+#endif
+        }
+    }
+
+    // Close the window when its frame returns (checked by __csi_func_exit).
+    void OnWindowFrameExit() {
+        if (windowOpen.load(std::memory_order_relaxed))
+            StopTracking();
+    }
+
+    // Region annotations (cilkmem.h): in dormant mode, a region is a window opened and closed
+    // by the program, in the calling frame.
+    void cilkmem_region_begin(const char* name) {
+        if (!dormant || hookState.log != nullptr)
+            return;
+
+        // Other workers may open a window at the same time, at a region or a dormant point.
+        bool closed = false;
+        if (!windowOpen.compare_exchange_strong(closed, true, std::memory_order_relaxed))
+        {
+            alwaysOut << "WARNING: region " << (name != nullptr ? name : "") << " ignored, another window is open\n";
+            return;
+        }
+
+        hookState.EnterInstrumentation();
+        regionWindow = true;
+        windowName = name != nullptr ? name : "";
+        StartTracking(currentLevel);
+        hookState.ExitInstrumentation();
+    }
+
+    void cilkmem_region_end() {
+        if (!dormant || hookState.log == nullptr)
+            return;
+
+        hookState.EnterInstrumentation();
+
+        // Only the frame that began the region ends it, once it has no outstanding children:
+        // before its next cilk_sync, the end is deferred to it, like a stop request.
+        if (regionWindow && currentLevel == windowLevel && !windowSpawned.load(std::memory_order_relaxed))
+            StopTracking();
+        else if (regionWindow && currentLevel == windowLevel)
+            trackingRequest.store(REQUEST_STOP, std::memory_order_relaxed);
+        else
+            alwaysOut << "WARNING: region end ignored, the window wasn't opened by a region in this frame\n";
+
+        hookState.ExitInstrumentation();
     }
 
     std::unordered_map<void*, size_t> allocs;
@@ -313,81 +1007,256 @@ extern "C" {
     void  __csi_after_call(const csi_id_t call_id, const csi_id_t func_id,
         const call_prop_t prop) {}
 
-    void  __attribute__((noinline))  __csi_detach(const csi_id_t detach_id, const int32_t* has_spawned) {
-        inInstrumentation = true;
+    // Keep the continuation of a spawn from 'frame' until it is resumed.
+    void PushContinuation(uintptr_t frame, SPStrandLog* continuation) {
+        if (continuationStack == nullptr)
+        {
+            ContinuationStack* stack = new ContinuationStack();
+            stack->nextStack = continuationStacks.load(std::memory_order_relaxed);
+            while (!continuationStacks.compare_exchange_weak(stack->nextStack, stack, std::memory_order_release, std::memory_order_relaxed))
+                ;
+            continuationStack = stack;
+        }
+
+        if (!continuationStack->Push(frame, continuation))
+        {
+            pendingContinuations.Put(frame, continuation);
+            numPendingInMap.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // Find a continuation of 'frame' that isn't the innermost one of the calling worker: it was
+    // stolen, or its spawn was nested too deep for the stack.
+    __attribute__((noinline)) SPStrandLog* TakeContinuation(uintptr_t frame) {
+        for (ContinuationStack* stack = continuationStacks.load(std::memory_order_acquire); stack != nullptr; stack = stack->nextStack)
+        {
+            SPStrandLog* continuation = stack->Claim(frame);
+            if (continuation != nullptr)
+                return continuation;
+        }
+
+        if (numPendingInMap.load(std::memory_order_relaxed) == 0)
+            return nullptr;
+
+        SPStrandLog* continuation = pendingContinuations.Take(frame);
+        if (continuation != nullptr)
+            numPendingInMap.fetch_sub(1, std::memory_order_relaxed);
+        return continuation;
+    }
+
+    // The continuation that may be stolen is identified by the spawning function's frame: not
+    // inlined, so that the saved frame pointer is the function's, as in __csi_func_entry.
+    __attribute__((noinline)) void __csi_detach(const csi_id_t detach_id, const int32_t* has_spawned) {
+        SPStrandLog* log = hookState.log;
+        if (log == nullptr)
+        {
+            if (trackingRequest.load(std::memory_order_relaxed) == REQUEST_NONE)
+                return;
+
+            OnDormantPoint(true, *has_spawned == 0);
+            log = hookState.log;
+            if (log == nullptr)
+                return;
+        }
+        else if (trackingRequest.load(std::memory_order_relaxed) == REQUEST_STOP && *has_spawned == 0 && currentLevel == windowLevel)
+        {
+            hookState.EnterInstrumentation();
+            trackingRequest.store(REQUEST_NONE, std::memory_order_relaxed);
+            StopTracking();
+            hookState.ExitInstrumentation();
+            return;
+        }
+
+        hookState.EnterInstrumentation();
+        const CSIMetadata::SourceLocation& location = csiMetadata.GetDetach(detach_id);
+
+#ifdef NO_FUNC_HOOKS
+        if (!exitHandlerRegistered)
+            RegisterExitHandler();
+#endif
+
         OUTPUT(out << "Spawn id " << detach_id << " (spawned: " << *has_spawned << ") - Addr: " << has_spawned
             << " - Level: " << currentLevel;);
-        if (__csi_get_detach_source_loc(detach_id)->name != nullptr)
+        if (location.name != nullptr)
         {
-            OUTPUT(out << " - Source: " << __csi_get_detach_source_loc(detach_id)->name << ":" << __csi_get_detach_source_loc(detach_id)->line_number);
+            OUTPUT(out << " - Source: " << location.name << ":" << location.line);
         }
         OUTPUT(out << "\n");
 
-        dag->Spawn(currentEdge, (uintptr_t)has_spawned);
-        if (showSource && __csi_get_detach_source_loc(detach_id)->name != nullptr)
-            dag->SetLastNodeLocation((char*)__csi_get_detach_source_loc(detach_id)->name, __csi_get_detach_source_loc(detach_id)->line_number);
+        ChargeResidency(log);
 
+        log->Append(true, (uintptr_t)has_spawned, currentLevel, location.name, location.line);
 
-        currentEdge = SPEdgeData();
+        if (currentLevel == windowLevel)
+            windowSpawned.store(true, std::memory_order_relaxed);
+        if (phases && !phaseSpawned.load(std::memory_order_relaxed))
+            phaseSpawned.store(true, std::memory_order_relaxed);
 
-        OUTPUT(out << "-----------------------\n");
+        // The spawned task runs on this worker, while the continuation can be
+        // picked up by whichever worker executes __csi_detach_continue.
+        SPStrandLog* task = new SPStrandLog();
+        SPStrandLog* continuation = new SPStrandLog();
+        continuation->level = currentLevel;
+        continuation->exitNext = log->exitNext;
+        task->exitNext = continuation;
 
-        if (runOnline && !aggregatingThread) // Start aggregation online.
-            aggregatingThread = new std::thread{ AggregateComponentsOnline };
+#ifdef USE_SPAWN_SITES
+        task->currentEdge.site = CSIMetadata::MakeSite(CSIMetadata::SITE_SPAWN, detach_id);
+        continuation->currentEdge.site = CSIMetadata::MakeSite(CSIMetadata::SITE_CONTINUATION, detach_id);
+#endif
+
+        PushContinuation(*(uintptr_t*)__builtin_frame_address(0), continuation);
+
+        log->Close(task);
+        SetStrandLog(task);
 
-        inInstrumentation = false;
+        OUTPUT(out << "-----------------------\n");
+
+        hookState.ExitInstrumentation();
     }
 
     void __csi_task(const csi_id_t task_id, const csi_id_t detach_id) {}
 
     void __csi_task_exit(const csi_id_t task_exit_id, const csi_id_t task_id,
         const csi_id_t detach_id) {
-        inInstrumentation = true;
+        SPStrandLog* log = hookState.log;
+        if (log == nullptr)
+            return;
+
+        hookState.EnterInstrumentation();
+        const CSIMetadata::SourceLocation& location = csiMetadata.GetTaskExit(task_exit_id);
 
         OUTPUT(out << "Task exit ");
-        OUTPUT(out << " - Source: " << __csi_get_task_exit_source_loc(task_exit_id)->name << ":" << __csi_get_task_exit_source_loc(task_exit_id)->line_number);
+        if (location.name != nullptr)
+        {
+            OUTPUT(out << " - Source: " << location.name << ":" << location.line);
+        }
         OUTPUT(out << "\n");
 
-        dag->Sync(currentEdge, 0);
-        if (showSource && __csi_get_task_exit_source_loc(task_exit_id)->name != nullptr)
-            dag->SetLastNodeLocation((char*)__csi_get_task_exit_source_loc(task_exit_id)->name, __csi_get_task_exit_source_loc(task_exit_id)->line_number);
+        ChargeResidency(log);
 
+        log->Append(false, 0, currentLevel, location.name, location.line);
 
-        currentEdge = SPEdgeData();
+        // Whatever this worker does next belongs to another strand.
+        log->Close(log->exitNext);
+        SetStrandLog(nullptr);
 
         OUTPUT(out << "-----------------------\n");
 
-        inInstrumentation = false;
+        hookState.ExitInstrumentation();
+    }
+
+    // Not inlined, see __csi_detach.
+    __attribute__((noinline)) void __csi_detach_continue(const csi_id_t detach_continue_id,
+        const csi_id_t detach_id) {
+        uintptr_t frame = *(uintptr_t*)__builtin_frame_address(0);
+        SPStrandLog* continuation = continuationStack != nullptr ? continuationStack->Pop(frame) : nullptr;
+
+        // The continuations of a window are resumed before the sync that closes it.
+        if (continuation == nullptr)
+        {
+            if (!windowOpen.load(std::memory_order_relaxed))
+                return;
+
+            continuation = TakeContinuation(frame);
+            if (continuation == nullptr)
+                return;
+        }
+
+        SetStrandLog(continuation);
+        currentLevel = continuation->level;
     }
 
-    void __csi_detach_continue(const csi_id_t detach_continue_id,
-        const csi_id_t detach_id) {}
+    void __csi_before_sync(const csi_id_t sync_id, const int32_t * has_spawned) {
+        SPStrandLog* log = hookState.log;
+        if (log == nullptr || *has_spawned <= 0)
+            return;
+
+        // The frame may resume on a different worker after the sync.
+        hookState.EnterInstrumentation();
+
+        ChargeResidency(log);
 
-    void __csi_before_sync(const csi_id_t sync_id, const int32_t * has_spawned) {}
+        log->level = currentLevel;
+        suspendedSyncs.Put((uintptr_t)has_spawned, log);
+        SetStrandLog(nullptr);
+
+        hookState.ExitInstrumentation();
+    }
 
     void  __attribute__((noinline))  __csi_after_sync(const csi_id_t sync_id, const int32_t * has_spawned) {
+        if (*has_spawned <= 0)
+            return;
+
+        if (!windowOpen.load(std::memory_order_relaxed))
+        {
+            // The frame has no outstanding children after the sync.
+            if (trackingRequest.load(std::memory_order_relaxed) != REQUEST_NONE)
+                OnDormantPoint(false, true);
+            return;
+        }
+
+        hookState.EnterInstrumentation();
+
+        SPStrandLog* log = suspendedSyncs.Take((uintptr_t)has_spawned);
+        if (log == nullptr)
+        {
+            hookState.ExitInstrumentation();
+            return;
+        }
 
-        inInstrumentation = true;
+        SetStrandLog(log);
+        currentLevel = log->level;
+        const CSIMetadata::SourceLocation& location = csiMetadata.GetSync(sync_id);
 
         OUTPUT(out << "Sync id " << sync_id << " (spawned: " << *has_spawned << ") - Addr: " << has_spawned
             << " - Level: " << currentLevel);
-        if (__csi_get_sync_source_loc(sync_id)->name != nullptr)
+        if (location.name != nullptr)
         {
-            OUTPUT(out << " - Source: " << __csi_get_sync_source_loc(sync_id)->name << ":" << __csi_get_sync_source_loc(sync_id)->line_number);
+            OUTPUT(out << " - Source: " << location.name << ":" << location.line);
         }
         OUTPUT(out << "\n");
 
-        if (*has_spawned <= 0)
-            return;
+        ChargeResidency(log);
+
+        log->Append(false, (uintptr_t)has_spawned, currentLevel, location.name, location.line);
 
-        dag->Sync(currentEdge, (uintptr_t)has_spawned);
-        if (showSource && __csi_get_sync_source_loc(sync_id)->name != nullptr)
-            dag->SetLastNodeLocation((char*)__csi_get_sync_source_loc(sync_id)->name, __csi_get_sync_source_loc(sync_id)->line_number);
+#ifdef USE_SPAWN_SITES
+        log->currentEdge.site = CSIMetadata::MakeSite(CSIMetadata::SITE_SYNC, sync_id);
+#endif
+
+        // Merge the logs of the strands that are now complete.
+        TryReplayStrandLogs();
 
-        currentEdge = SPEdgeData();
+        if (currentLevel == windowLevel)
+            windowSpawned.store(false, std::memory_order_relaxed);
+
+        if (trackingRequest.load(std::memory_order_relaxed) == REQUEST_STOP && currentLevel == windowLevel)
+        {
+            trackingRequest.store(REQUEST_NONE, std::memory_order_relaxed);
+            StopTracking();
+        }
+        // A call of the window's frame has no outstanding children either after its syncs.
+        else if (phases && (currentLevel == windowLevel || (currentLevel == windowLevel + 1 && !windowSpawned.load(std::memory_order_relaxed))))
+            EndPhase();
 
         OUTPUT(out << "-----------------------\n");
 
-        inInstrumentation = false;
+        hookState.ExitInstrumentation();
     }
 }
+
+#ifdef NO_FUNC_HOOKS
+// Without function hooks, there is no entry of main to start tracking at: start once the
+// globals above are initialized (the CSI units are initialized before).
+struct ProgramTracker {
+    ProgramTracker() {
+        hookState.EnterInstrumentation();
+        program_start();
+        // As from the entry of main to its exit with function hooks: the blocks the program
+        // releases are only freed while it runs.
+        started = true;
+        hookState.ExitInstrumentation();
+    }
+} programTracker;
+#endif
@@ -0,0 +1,65 @@
+#include <iostream>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+
+// OpenMP version of test.cpp's stress test, for the OpenMP front-end (make instr-omp).
+
+void* mem = nullptr;
+
+__attribute__((noinline)) uint64_t stress(uint64_t n) {
+    if (n == 0)
+    {
+        mem = malloc(50);
+        free(mem);
+        return 1;
+    }
+    void* nowmem = nullptr;
+
+    nowmem = malloc(n * 100);
+
+    mem = nowmem;
+
+    #pragma omp task
+    stress(n - 1);
+    auto x = stress(n - 1);
+
+    free(nowmem);
+
+    #pragma omp taskwait
+    return x;
+}
+
+uint64_t x = 0;
+
+
+int main(int argc, char** argv) {
+    uint64_t n = 10;
+    uint64_t k = 5;
+    uint64_t o = 1;
+
+    if (argc > 1)
+    {
+        n = std::atoi(argv[1]);
+    }
+    if (argc > 2)
+    {
+        k = std::atoi(argv[2]);
+    }
+    if (argc > 3)
+    {
+        o = std::atoi(argv[3]);
+    }
+
+    #pragma omp parallel
+    #pragma omp single
+    for (size_t j = 0; j < o; ++j)
+    {
+        for (size_t i = 0; i < k; ++i)
+        {
+            x = stress(n);
+        }
+    }
+
+    return 0;
+}